@@ -0,0 +1,639 @@
+/* SNOWBENCH - Microbenchmarks for the hot paths of SNOW
+ *
+ * Times the palette row blit, building an rcimg palette cube and importing a
+ * truecolor image through it, picking spawn columns, the rcgl drawing calls,
+ * one simulation step at several particle counts and on a 4K world that has
+ * been snowing a while, taking an obstacle away and putting it back, and a
+ * tick of the RAD player. Every case is warmed up first, then run for a
+ * number of samples each long enough for the clock to be trusted, and the
+ * spread of the samples is reported in ns per call.
+ *
+ * Results are written as JSON so runs can be kept and compared across
+ * commits, a summary table goes to stderr.
+ *
+ * usage: snowbench [-l label] [-o out.json] [-q] [pack]
+ *   -l  Label stored with the results, e.g. a commit id
+ *   -o  Write the JSON to a file rather than stdout
+ *   -q  No summary table
+ *
+ * The drawing cases need a display for their (hidden) window, and are
+ * skipped if one can't be opened.
+ */
+#include "rcgl.h"
+#include "rcglint.h"
+#include "rcimg.h"
+#include "rcpak.h"
+#include "rad.h"
+#include "scene.h"
+#include "sim.h"
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WARMUP      3           // Untimed samples before each case
+#define SAMPLES     31
+#define MINSAMPLE   2000000     // ns, iterations are doubled until a sample
+                                // takes at least this long
+#define MAXCASES    32
+
+struct bench {
+	const char *name;
+	void (*reset)(void *arg);   // Untimed, before every sample
+	void (*run)(void *arg, long iters);
+	void *arg;
+	long maxiters;              // Cases that change state as they go
+};
+
+struct result {
+	char name[32];
+	long iters;
+	double min, median, mean, max, stddev;  // ns per call
+};
+
+static struct result results[MAXCASES];
+static int nresults;
+
+static uint64_t now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000000000 + t.tv_nsec;
+}
+
+static int cmpdbl(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * sample - Time one sample of iters calls, in ns
+ */
+static uint64_t sample(const struct bench *b, long iters)
+{
+	uint64_t t0;
+
+	if (b->reset)
+		b->reset(b->arg);
+	t0 = now();
+	b->run(b->arg, iters);
+	return now() - t0;
+}
+
+/*
+ * measure - Calibrate, warm up and time a case, adding it to results
+ */
+static void measure(const struct bench *b)
+{
+	struct result *r = &results[nresults];
+	double t[SAMPLES], sum = 0, var = 0;
+	long iters = 1;
+
+	if (nresults == MAXCASES)
+		return;
+	while (iters < b->maxiters && sample(b, iters) < MINSAMPLE)
+		iters *= 2;
+	if (iters > b->maxiters)
+		iters = b->maxiters;
+	for (int i = 0; i < WARMUP; i++)
+		sample(b, iters);
+	for (int i = 0; i < SAMPLES; i++) {
+		t[i] = (double)sample(b, iters) / iters;
+		sum += t[i];
+	}
+	snprintf(r->name, sizeof(r->name), "%s", b->name);
+	r->iters = iters;
+	r->mean = sum / SAMPLES;
+	for (int i = 0; i < SAMPLES; i++)
+		var += (t[i] - r->mean) * (t[i] - r->mean);
+	r->stddev = sqrt(var / (SAMPLES - 1));
+	qsort(t, SAMPLES, sizeof(*t), cmpdbl);
+	r->min = t[0];
+	r->median = t[SAMPLES/2];
+	r->max = t[SAMPLES-1];
+	nresults++;
+}
+
+
+/* CASES */
+
+static const uint32_t *vgapal;
+static struct rcrng rng;
+static uint8_t *tree;
+static int treew, treeh;
+
+/* rcgl_blitrow, one 320 pixel row */
+static uint8_t rowsrc[SIM_WID];
+static uint32_t rowdst[SIM_WID];
+
+static void run_blitrow(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++)
+		rcgl_blitrow(vgapal, rowsrc, rowdst, SIM_WID);
+}
+
+/* rcimg, building the cube for a palette and loading a 320x200 PPM through
+ * it with and without the dither, the file staying in the page cache */
+static struct rcimg_cube cube;
+static char imgpath[] = "/tmp/snowbenchXXXXXX";
+static int nodither = 0, withdither = RCIMG_DITHER;
+
+/*
+ * img_init - Write the test image, a colour ramp with some noise over it
+ */
+static int img_init(void)
+{
+	FILE *fp;
+	int fd;
+
+	if ((fd = mkstemp(imgpath)) < 0)
+		return -1;
+	if ((fp = fdopen(fd, "wb")) == NULL) {
+		close(fd);
+		unlink(imgpath);
+		return -1;
+	}
+	fprintf(fp, "P6\n%d %d\n255\n", SIM_WID, SIM_HGT);
+	for (int y = 0; y < SIM_HGT; y++)
+		for (int x = 0; x < SIM_WID; x++) {
+			fputc(x * 255 / (SIM_WID-1), fp);
+			fputc(y * 255 / (SIM_HGT-1), fp);
+			fputc(rcrng_below(&rng, 256), fp);
+		}
+	if (fclose(fp) != 0) {
+		unlink(imgpath);
+		return -1;
+	}
+	rcimg_buildcube(&cube, vgapal);
+	return 0;
+}
+
+static void run_buildcube(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++)
+		rcimg_buildcube(&cube, vgapal);
+}
+
+static void run_imgload(void *arg, long iters)
+{
+	int flags = *(int *)arg, w, h;
+	uint8_t *img;
+
+	for (long i = 0; i < iters; i++) {
+		if ((img = rcimg_load(imgpath, &cube, flags, &w, &h)) == NULL)
+			exit(1);
+		free(img);
+	}
+}
+
+/* Spawn columns, rand against one rcrng draw and a batch of RCRNG_LANES */
+static volatile uint32_t sink;
+static struct rcrng8 rng8;
+
+static void run_rand(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++)
+		sink = rand() % SIM_WID;
+}
+
+static void run_rcrng(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++)
+		sink = rcrng_below(&rng, SIM_WID);
+}
+
+static void run_rcrng8(void *arg, long iters)
+{
+	uint32_t x[RCRNG_LANES];
+
+	(void)arg;
+	for (long i = 0; i < iters; i++) {
+		rcrng8_below(&rng8, SIM_WID, x);
+		sink = x[0];
+	}
+}
+
+/* rcgl drawing calls on a hidden window */
+#define NLINES 256
+static int lines[NLINES][4];
+static uint8_t plt[256];
+
+static void run_plot(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++)
+		rcgl_plot(i % SIM_WID, (i / SIM_WID) % SIM_HGT, i);
+}
+
+static void run_line(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++) {
+		int *l = lines[i % NLINES];
+		rcgl_line(l[0], l[1], l[2], l[3], i);
+	}
+}
+
+static void run_blit(void *arg, long iters)
+{
+	uint8_t *p = arg;
+	for (long i = 0; i < iters; i++)
+		rcgl_blit(tree, i % (SIM_WID-treew), i % (SIM_HGT-treeh), treew, treeh,
+		          0, p);
+}
+
+static void run_update(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++)
+		rcgl_update();
+}
+
+/* sim_step from the same warmed up scene every sample */
+struct simcase {
+	struct sim sim;
+	int n;
+	const struct rcpak *pak;
+	char name[32];
+};
+
+#define SIMWARM     50      // Steps before each sample, so flakes are spread
+#define SIMSTEPS    256     // Most steps per sample, keeps clear of a full screen
+
+/*
+ * simcase_build - Set up the scene from scratch
+ *
+ * Rebuilt for every sample rather than restored from a snapshot, there is
+ * too much state between the scene, the bitmaps and the landing queue.
+ */
+static int simcase_build(struct simcase *c)
+{
+	const uint8_t *spr;
+	int w, h;
+
+	sim_free(&c->sim);
+	if (sim_init(&c->sim, SIM_WID, SIM_HGT, c->n, 1) < 0)
+		return -1;
+	if ((spr = rcpak_sprite(c->pak, "tree", &w, &h)) != NULL)
+		sim_sprite(&c->sim, spr, 40, 199-h, w, h);
+	if ((spr = rcpak_sprite(c->pak, "merry", &w, &h)) != NULL)
+		sim_sprite(&c->sim, spr, 170, 120, w, h);
+	if (sim_spawn(&c->sim) < 0)
+		return -1;
+	for (int i = 0; i < SIMWARM; i++)
+		sim_step(&c->sim);
+	return 0;
+}
+
+static int simcase_init(struct simcase *c, int n, const struct rcpak *pak)
+{
+	memset(c, 0, sizeof(*c));
+	snprintf(c->name, sizeof(c->name), "sim_step_%d", n);
+	c->n = n;
+	c->pak = pak;
+	return simcase_build(c);
+}
+
+static void simcase_free(struct simcase *c)
+{
+	sim_free(&c->sim);
+}
+
+static void reset_sim(void *arg)
+{
+	struct simcase *c = arg;
+	if (simcase_build(c) < 0) {
+		fprintf(stderr, "snowbench: Failed to set up %d flakes\n", c->n);
+		exit(1);
+	}
+}
+
+static void run_sim(void *arg, long iters)
+{
+	struct simcase *c = arg;
+	for (long i = 0; i < iters; i++)
+		sim_step(&c->sim);
+}
+
+/* sim_step on a 4K screen of the default scene, carrying on between samples
+ * once the snow has built up, the thaw holding it steady */
+#define BIGWID      3840
+#define BIGHGT      2160
+#define BIGWARM     20000
+static struct sim bigsim;
+
+static int big_init(const struct rcpak *pak)
+{
+	struct scene sc;
+	struct sim_mask m;
+	const uint8_t *spr;
+	int i, w, h, x, y, rval;
+
+	scene_default(&sc);
+	if (sim_init(&bigsim, BIGWID, BIGHGT, (long)sc.flakes * BIGWID * BIGHGT
+	                                      / (SCENE_WID*SCENE_HGT), 1) < 0)
+		return -1;
+	for (i = 0; i < sc.nsprites; i++) {
+		spr = rcpak_sprite(pak, sc.sprites[i].name, &w, &h);
+		if (spr == NULL || sim_maskinit(&m, spr, w, h) < 0)
+			return -1;
+		scene_place(&sc.sprites[i], w, h, BIGWID, BIGHGT, &x, &y);
+		rval = sim_stamp(&bigsim, &m, x, y);
+		sim_maskfree(&m);
+		if (rval < 0)
+			return -1;
+	}
+	sim_thaw(&bigsim, 30);
+	if (sim_spawn(&bigsim) < 0)
+		return -1;
+	for (i = 0; i < BIGWARM; i++)
+		sim_step(&bigsim);
+	return 0;
+}
+
+static void run_big(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++)
+		sim_step(&bigsim);
+}
+
+/* Taking the merry sign down and putting it back up, on a snowed in scene */
+#define STAMPWARM   2000
+static struct sim stampsim;
+static struct sim_mask merrymask;
+
+static int stamp_init(const struct rcpak *pak)
+{
+	const uint8_t *spr;
+	int w, h;
+
+	if ((spr = rcpak_sprite(pak, "merry", &w, &h)) == NULL
+	    || sim_maskinit(&merrymask, spr, w, h) < 0
+	    || sim_init(&stampsim, SIM_WID, SIM_HGT, 200, 1) < 0
+	    || sim_stamp(&stampsim, &merrymask, 170, 120) < 0
+	    || sim_spawn(&stampsim) < 0)
+		return -1;
+	for (int i = 0; i < STAMPWARM; i++)
+		sim_step(&stampsim);
+	return 0;
+}
+
+static void run_stamp(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++) {
+		sim_unstamp(&stampsim, &merrymask, 170, 120);
+		sim_stamp(&stampsim, &merrymask, 170, 120);
+	}
+}
+
+/* rad_play against an OPL that goes nowhere */
+static struct rad rad;
+static uint8_t song[4096];
+static size_t songlen;
+static volatile uint32_t oplsink;
+
+static void nullopl(void *ud, uint8_t reg, uint8_t val)
+{
+	(void)ud;
+	oplsink += reg ^ val;
+}
+
+/*
+ * makesong - Build a RAD song that keeps every channel busy with slides
+ *
+ * One 64 line pattern looped forever at speed 1, so a new line is read every
+ * tick. Each line starts a note on every channel with a port slide, tone
+ * slide or volume slide, the effects doeffects spends its time on.
+ */
+static size_t makesong(uint8_t *p)
+{
+	static const uint8_t inst[11] = {
+		0x01, 0x01, 0x10, 0x00, 0xF0, 0xF0, 0x74, 0x74, 0x00, 0x00, 0x00
+	};
+	static const uint8_t cmds[4] = { 1, 2, 3, 10 };
+	size_t pos, pat;
+
+	memset(p, 0, 18);
+	memcpy(p, "RAD by REALiTY!!", 16);
+	p[0x10] = 0x10;             // Version 1.0
+	p[0x11] = 1;                // Speed 1, fast, no description
+	pos = 18;
+	p[pos++] = 1;               // Instrument 1
+	memcpy(p + pos, inst, sizeof(inst));
+	pos += sizeof(inst);
+	p[pos++] = 0;
+	p[pos++] = 2;               // Orders: pattern 0, then jump back to order 0
+	p[pos++] = 0;
+	p[pos++] = 0x80;
+	pat = pos + 64;
+	memset(p + pos, 0, 64);
+	p[pos] = pat & 0xFF;
+	p[pos+1] = pat >> 8;
+	pos = pat;
+	for (int line = 0; line < 64; line++) {
+		p[pos++] = line | (line == 63 ? 0x80 : 0);
+		for (int ch = 0; ch < RAD_CHANS; ch++) {
+			uint8_t cmd = cmds[(line + ch) % 4];
+			p[pos++] = ch | (ch == RAD_CHANS-1 ? 0x80 : 0);
+			p[pos++] = ((2 + (line+ch) % 5) << 4) | (1 + (line*7 + ch) % 12);
+			p[pos++] = 0x10 | cmd;
+			p[pos++] = cmd == 3 ? 0x08 : cmd == 10 ? 0x03 : 0x02;
+		}
+	}
+	return pos;
+}
+
+static void reset_rad(void *arg)
+{
+	(void)arg;
+	rad_load(&rad, song, songlen, nullopl, NULL);
+}
+
+static void run_rad(void *arg, long iters)
+{
+	(void)arg;
+	for (long i = 0; i < iters; i++)
+		rad_play(&rad);
+}
+
+
+/* OUTPUT */
+
+static void writejson(FILE *f, const char *label)
+{
+	char date[32];
+	time_t t = time(NULL);
+
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&t));
+	fprintf(f, "{\n");
+	fprintf(f, "  \"label\": \"%s\",\n", label ? label : "");
+	fprintf(f, "  \"date\": \"%s\",\n", date);
+	fprintf(f, "  \"samples\": %d,\n", SAMPLES);
+	fprintf(f, "  \"unit\": \"ns/op\",\n");
+	fprintf(f, "  \"benchmarks\": [\n");
+	for (int i = 0; i < nresults; i++) {
+		struct result *r = &results[i];
+		fprintf(f, "    {\"name\": \"%s\", \"iters\": %ld, \"min\": %.2f, "
+		        "\"median\": %.2f, \"mean\": %.2f, \"max\": %.2f, "
+		        "\"stddev\": %.2f}%s\n", r->name, r->iters, r->min,
+		        r->median, r->mean, r->max, r->stddev,
+		        i == nresults-1 ? "" : ",");
+	}
+	fprintf(f, "  ]\n}\n");
+}
+
+static void writetable(FILE *f)
+{
+	fprintf(f, "%-20s %10s %12s %12s %12s %10s\n", "benchmark", "iters",
+	        "min ns", "median ns", "mean ns", "stddev");
+	for (int i = 0; i < nresults; i++) {
+		struct result *r = &results[i];
+		fprintf(f, "%-20s %10ld %12.2f %12.2f %12.2f %10.2f\n", r->name,
+		        r->iters, r->min, r->median, r->mean, r->stddev);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	static const int counts[] = { 100, 200, 1000, 4000 };
+	struct simcase sims[sizeof(counts)/sizeof(counts[0])];
+	const char *label = NULL, *out = NULL;
+	struct rcpak pak;
+	const uint8_t *spr;
+	FILE *f = stdout;
+	int quiet = 0, opt;
+
+	while ((opt = getopt(argc, argv, "l:o:q")) != -1) {
+		switch (opt) {
+		case 'l':
+			label = optarg;
+			break;
+		case 'o':
+			out = optarg;
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		default:
+			fprintf(stderr, "usage: snowbench [-l label] [-o out.json] [-q] "
+			        "[pack]\n");
+			return -1;
+		}
+	}
+
+	if (rcpak_open(&pak, optind < argc ? argv[optind] : "snow.pak") < 0)
+		return -1;
+	spr = rcpak_sprite(&pak, "tree", &treew, &treeh);
+	vgapal = rcpak_palette(&pak, "vga");
+	if (spr == NULL || vgapal == NULL) {
+		fprintf(stderr, "snowbench: Asset pack is missing tree or vga\n");
+		return -1;
+	}
+	/* rcgl_blit wants a writable sprite */
+	if ((tree = malloc(treew*treeh)) == NULL)
+		return -1;
+	memcpy(tree, spr, treew*treeh);
+
+	rcrng_seed(&rng, 1, 0);
+	for (int i = 0; i < SIM_WID; i++)
+		rowsrc[i] = rcrng_next(&rng);
+	for (int i = 0; i < NLINES; i++) {
+		lines[i][0] = rcrng_below(&rng, SIM_WID);
+		lines[i][1] = rcrng_below(&rng, SIM_HGT);
+		lines[i][2] = rcrng_below(&rng, SIM_WID);
+		lines[i][3] = rcrng_below(&rng, SIM_HGT);
+	}
+	rcrng8_seed(&rng8, &rng);
+	for (int i = 0; i < 256; i++)
+		plt[i] = 255 - i;
+
+	measure(&(struct bench){ "rcgl_blitrow_320", NULL, run_blitrow, NULL,
+	                         1L<<30 });
+	if (img_init() < 0) {
+		fprintf(stderr, "snowbench: Failed to write the test image\n");
+		return -1;
+	}
+	measure(&(struct bench){ "rcimg_buildcube", NULL, run_buildcube, NULL,
+	                         1L<<30 });
+	measure(&(struct bench){ "rcimg_load_320", NULL, run_imgload, &nodither,
+	                         1L<<30 });
+	measure(&(struct bench){ "rcimg_dither_320", NULL, run_imgload,
+	                         &withdither, 1L<<30 });
+	unlink(imgpath);
+	measure(&(struct bench){ "rand_320", NULL, run_rand, NULL, 1L<<30 });
+	measure(&(struct bench){ "rcrng_below_320", NULL, run_rcrng, NULL,
+	                         1L<<30 });
+	measure(&(struct bench){ "rcrng8_below_320", NULL, run_rcrng8, NULL,
+	                         1L<<30 });
+
+	if (rcgl_init(SIM_WID, SIM_HGT, SIM_WID, SIM_HGT, "snowbench",
+	              RCGL_HIDDEN) == 0) {
+		rcgl_setpalette(vgapal);
+		measure(&(struct bench){ "rcgl_plot", NULL, run_plot, NULL, 1L<<30 });
+		measure(&(struct bench){ "rcgl_line", NULL, run_line, NULL, 1L<<30 });
+		measure(&(struct bench){ "rcgl_blit", NULL, run_blit, NULL, 1L<<30 });
+		measure(&(struct bench){ "rcgl_blit_plt", NULL, run_blit, plt,
+		                         1L<<30 });
+		measure(&(struct bench){ "rcgl_update", NULL, run_update, NULL,
+		                         1L<<30 });
+		rcgl_quit();
+	} else {
+		fprintf(stderr, "snowbench: No display, skipping rcgl cases\n");
+	}
+
+	for (size_t i = 0; i < sizeof(counts)/sizeof(counts[0]); i++) {
+		if (simcase_init(&sims[i], counts[i], &pak) < 0) {
+			fprintf(stderr, "snowbench: Failed to set up %d flakes\n",
+			        counts[i]);
+			return -1;
+		}
+		measure(&(struct bench){ sims[i].name, reset_sim, run_sim, &sims[i],
+		                         SIMSTEPS });
+		simcase_free(&sims[i]);
+	}
+
+	if (big_init(&pak) < 0) {
+		fprintf(stderr, "snowbench: Failed to set up the 4K scene\n");
+		return -1;
+	}
+	measure(&(struct bench){ "sim_step_4k", NULL, run_big, NULL, 1L<<30 });
+	sim_free(&bigsim);
+
+	if (stamp_init(&pak) < 0) {
+		fprintf(stderr, "snowbench: Failed to set up the stamp scene\n");
+		return -1;
+	}
+	measure(&(struct bench){ "sim_unstamp_stamp", NULL, run_stamp, NULL,
+	                         1L<<30 });
+	sim_free(&stampsim);
+	sim_maskfree(&merrymask);
+
+	songlen = makesong(song);
+	if (rad_load(&rad, song, songlen, nullopl, NULL) < 0) {
+		fprintf(stderr, "snowbench: Built a bad RAD song\n");
+		return -1;
+	}
+	measure(&(struct bench){ "rad_play", reset_rad, run_rad, NULL, 1L<<30 });
+
+	if (out && (f = fopen(out, "w")) == NULL) {
+		fprintf(stderr, "snowbench: Failed to open %s\n", out);
+		return -1;
+	}
+	writejson(f, label);
+	if (f != stdout)
+		fclose(f);
+	if (!quiet)
+		writetable(stderr);
+	free(tree);
+	rcpak_close(&pak);
+	return 0;
+}
@@ -0,0 +1,228 @@
+/* MKPAK - Build an RCPAK asset pack
+ *
+ * Converts the sprites compiled in from vgatree.h and vgamerry.h along with
+ * the built-in RCGL palettes into a pack, optionally adding RAD songs, scene
+ * descriptions (.scene) and truecolor images given on the command line.
+ * Images (.bmp, .tga, .ppm) are dithered onto the VGA palette and stored as
+ * sprites. Asset names are the file name without directory or extension.
+ *
+ *   mkpak snow.pak [song.rad | snow.scene | image.bmp ...]
+ *
+ * See rcpak.h for the file layout, and rcgl.h for license (BSD 3-Clause).
+ */
+#include "rcgl.h"
+#include "rcimg.h"
+#include "rcpak.h"
+#include "vgatree.h"
+#include "vgamerry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#define MAX_ASSETS  64
+
+struct asset {
+	const char *name;
+	uint32_t type;
+	uint16_t w, h;
+	const void *data;
+	uint32_t len;
+};
+
+static struct asset assets[MAX_ASSETS];
+static int nassets;
+
+
+static void add(const char *name, uint32_t type, int w, int h,
+                const void *data, uint32_t len)
+{
+	if (nassets == MAX_ASSETS) {
+		fprintf(stderr, "mkpak: Too many assets\n");
+		exit(1);
+	}
+	assets[nassets].name = name;
+	assets[nassets].type = type;
+	assets[nassets].w = w;
+	assets[nassets].h = h;
+	assets[nassets].data = data;
+	assets[nassets].len = len;
+	nassets++;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	p[0] = v;
+	p[1] = v >> 8;
+	p[2] = v >> 16;
+	p[3] = v >> 24;
+}
+
+/* Palettes are stored as little-endian words regardless of the host */
+static void *palette(const uint32_t pal[256])
+{
+	uint8_t *p = malloc(256 * 4);
+
+	if (p == NULL) {
+		fprintf(stderr, "mkpak: Out of memory\n");
+		exit(1);
+	}
+	for (int i = 0; i < 256; i++)
+		put32(p + i*4, pal[i]);
+	return p;
+}
+
+/* Asset name from a path, the file name without directory or extension */
+static char *assetname(const char *path)
+{
+	const char *base = strrchr(path, '/');
+	char *name, *dot;
+
+	name = strdup(base ? base+1 : path);
+	if ((dot = strrchr(name, '.')) != NULL)
+		*dot = '\0';
+	if (strlen(name) > RCPAK_NAMELEN)
+		fprintf(stderr, "mkpak: Truncating asset name %s\n", name);
+	return name;
+}
+
+static void addimage(const char *path)
+{
+	static struct rcimg_cube cube;
+	static int havecube;
+	uint8_t *img;
+	int w, h;
+
+	if (!havecube) {
+		rcimg_buildcube(&cube, RCGL_PALETTE_VGA);
+		havecube = 1;
+	}
+	if ((img = rcimg_load(path, &cube, RCIMG_DITHER, &w, &h)) == NULL)
+		exit(1);
+	if (w > 0xFFFF || h > 0xFFFF) {
+		fprintf(stderr, "mkpak: %s is too large for a sprite\n", path);
+		exit(1);
+	}
+	add(assetname(path), RCPAK_SPRITE, w, h, img, w*h);
+}
+
+/* readfile - A whole file in memory, exits on failure */
+static uint8_t *readfile(const char *path, long *len)
+{
+	uint8_t *data;
+	FILE *fp;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		fprintf(stderr, "mkpak: Failed to open %s\n", path);
+		exit(1);
+	}
+	fseek(fp, 0, SEEK_END);
+	*len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	data = malloc(*len + 1);
+	if (data == NULL || fread(data, 1, *len, fp) != (size_t)*len) {
+		fprintf(stderr, "mkpak: Failed to read %s\n", path);
+		exit(1);
+	}
+	fclose(fp);
+	return data;
+}
+
+/* Scenes are stored as text, checked by snow when it loads them */
+static void addscene(const char *path)
+{
+	long len;
+	uint8_t *data = readfile(path, &len);
+
+	add(assetname(path), RCPAK_SCENE, 0, 0, data, len);
+}
+
+static void addrad(const char *path)
+{
+	long len;
+	uint8_t *data = readfile(path, &len);
+
+	if (len < 18 || memcmp(data, "RAD", 3) != 0) {
+		fprintf(stderr, "mkpak: %s is not a RAD file\n", path);
+		exit(1);
+	}
+
+	add(assetname(path), RCPAK_RAD, 0, 0, data, len);
+}
+
+int main(int argc, char **argv)
+{
+	uint8_t hdr[16], ent[32];
+	static const uint8_t pad[RCPAK_ALIGN];
+	uint32_t off;
+	FILE *fp;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: mkpak out.pak [song.rad | snow.scene | "
+		        "image.bmp ...]\n");
+		return 1;
+	}
+
+	add("tree", RCPAK_SPRITE, TREEWID, TREEHGT, tree, TREEWID*TREEHGT);
+	add("merry", RCPAK_SPRITE, MERRYWID, MERRYHGT, merry, MERRYWID*MERRYHGT);
+	add("vga", RCPAK_PALETTE, 256, 1, palette(RCGL_PALETTE_VGA), 256*4);
+	add("grey", RCPAK_PALETTE, 256, 1, palette(RCGL_PALETTE_GREY), 256*4);
+	for (i = 2; i < argc; i++) {
+		const char *ext = strrchr(argv[i], '.');
+		if (ext && (!strcasecmp(ext, ".bmp") || !strcasecmp(ext, ".tga")
+		            || !strcasecmp(ext, ".ppm")))
+			addimage(argv[i]);
+		else if (ext && !strcasecmp(ext, ".scene"))
+			addscene(argv[i]);
+		else
+			addrad(argv[i]);
+	}
+
+	if ((fp = fopen(argv[1], "wb")) == NULL) {
+		fprintf(stderr, "mkpak: Failed to create %s\n", argv[1]);
+		return 1;
+	}
+
+	memcpy(hdr, RCPAK_MAGIC, 4);
+	put32(hdr+4, RCPAK_VERSION);
+	put32(hdr+8, nassets);
+	put32(hdr+12, 0);
+	fwrite(hdr, 1, sizeof(hdr), fp);
+
+	// Data follows the index, each blob aligned so palettes can be used
+	// in place as uint32_t arrays
+	off = sizeof(hdr) + nassets * sizeof(ent);
+	for (i = 0; i < nassets; i++) {
+		off = (off + RCPAK_ALIGN-1) & ~(RCPAK_ALIGN-1);
+		memset(ent, 0, sizeof(ent));
+		strncpy((char *)ent, assets[i].name, RCPAK_NAMELEN);
+		put32(ent+16, assets[i].type);
+		put16(ent+20, assets[i].w);
+		put16(ent+22, assets[i].h);
+		put32(ent+24, off);
+		put32(ent+28, assets[i].len);
+		fwrite(ent, 1, sizeof(ent), fp);
+		off += assets[i].len;
+	}
+
+	off = sizeof(hdr) + nassets * sizeof(ent);
+	for (i = 0; i < nassets; i++) {
+		uint32_t aligned = (off + RCPAK_ALIGN-1) & ~(RCPAK_ALIGN-1);
+		fwrite(pad, 1, aligned - off, fp);
+		fwrite(assets[i].data, 1, assets[i].len, fp);
+		off = aligned + assets[i].len;
+	}
+
+	if (fclose(fp) != 0) {
+		fprintf(stderr, "mkpak: Failed writing %s\n", argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,517 @@
+/* RAD - Reality Adlib Tracker playback
+ *
+ * Ported from RADPLAY, written for Turbo C 2.01 on a PC/XT Clone, which
+ * played straight out of the timer interrupt. The routines are the same,
+ * with the globals gathered into struct rad and the port writes (and their
+ * delays) replaced by the opl callback.
+ */
+#include "rad.h"
+#include <string.h>
+
+#define HEADLEN     18      /* RAD header length */
+#define INSTLEN     11      /* Length of instrument definition */
+
+/* RAD Commands */
+#define CMD_PORTUP          1
+#define CMD_PORTDN          2
+#define CMD_TONESLIDE       3
+#define CMD_TONEVOLSLIDE    5
+#define CMD_VOLSLIDE        10
+#define CMD_SETVOL          12
+#define CMD_JMPLINE         13
+#define CMD_SETSPEED        15
+
+static const uint8_t al_choff[] = {
+	0x00, 0x01, 0x02, 0x08, 0x09, 0x0A, 0x10, 0x11, 0x12
+};
+
+/* Conversion of note to frequency.
+ * C = 0x156 (Low C below octave? We start at C#?)
+ *
+ * Taken from original Reality Tracker play routine.
+ */
+static const uint16_t notefreq[] = {
+	0x16b, 0x181, 0x198, 0x1b0, 0x1ca, 0x1e5,
+	0x202, 0x220, 0x241, 0x263, 0x287, 0x2ae
+};
+
+/* Range of one octave in frequency */
+#define NOTE_C  0x156
+#define OCTAVE	(0x2ae - NOTE_C)
+
+/* Convert octave and note to a linearized frequency for slides */
+#define linearfreq(oct, note) (((oct)*OCTAVE)+notefreq[(note)]-NOTE_C)
+#define linearfreq2(oct, freq) (((oct)*OCTAVE)+(freq)-NOTE_C)
+
+
+static void doeffects(struct rad *r);
+static int do_note(struct rad *r, uint8_t chan, uint8_t oct, uint8_t note,
+                   uint8_t cmd, uint8_t param, uint8_t inst);
+static void set_note(struct rad *r, uint8_t chan, uint8_t oct, uint8_t note);
+static void set_linear_freq(struct rad *r, uint8_t chan, short lfreq);
+static short get_linear_freq(struct rad *r, uint8_t chan);
+static void set_volume(struct rad *r, uint8_t chan, uint8_t vol);
+static uint8_t get_volume(struct rad *r, uint8_t chan);
+static void load_inst(struct rad *r, uint8_t i, uint8_t chan);
+static void al_clr(struct rad *r);
+
+#define al_write(r, port, val)  (r)->opl((r)->ud, (port), (val))
+
+
+/*
+ * rad_load - Parse a RAD file already in memory and get ready to play it
+ *
+ * The song is used in place, so must outlive the player. Register writes
+ * go to opl(ud, reg, val). Returns 0 on success, -1 if it isn't a version
+ * 1.0 RAD file or is cut short.
+ */
+int rad_load(struct rad *r, const uint8_t *song, size_t len, rad_opl opl,
+             void *ud)
+{
+	size_t pos = HEADLEN;
+	int ch;
+
+	memset(r, 0, sizeof(*r));
+	r->opl = opl;
+	r->ud = ud;
+
+	if (len < HEADLEN || song[0] != 'R' || song[1] != 'A' || song[2] != 'D')
+		return -1;
+	/* We only support version 1.0 RAD files */
+	if (song[0x10] != 0x10)
+		return -1;
+
+	r->speed = song[0x11] & 0x1F;           /* Initial speed */
+	r->slow = (song[0x11] & 0x40) != 0;     /* Fast(50Hz) or Slow (18.2Hz) */
+
+	if (song[0x11] & 0x80) {
+		/* Skip description */
+		while (pos < len && song[pos])
+			pos++;
+		pos++;
+	}
+
+	/* Load instruments */
+	while (pos < len && (ch = song[pos++]) != 0) {
+		if (ch > 31 || pos + INSTLEN > len)
+			return -1;
+		memcpy(&r->insts[ch-1], song + pos, INSTLEN);
+		pos += INSTLEN;
+	}
+
+	/* Load orders */
+	if (pos >= len || pos + 1 + song[pos] > len)
+		return -1;
+	r->orderlen = song[pos++];
+	memcpy(r->order, song + pos, r->orderlen);
+	pos += r->orderlen;
+
+	/* Load in pattern offset table */
+	if (pos + 64 > len)
+		return -1;
+	for (int i = 0; i < 32; i++)
+		r->patoff[i] = song[pos + i*2] | song[pos + i*2 + 1] << 8;
+	pos += 64;
+
+	r->data = song + pos;
+	r->datalen = len - pos;
+
+	/* Fixup patoff to be 0 based */
+	for (int i = 0; i < 32; i++) {
+		if (r->patoff[i]) {
+			if (r->patoff[i] < pos || r->patoff[i] - pos >= r->datalen)
+				return -1;
+			r->patoff[i] -= pos;
+		}
+	}
+
+	/* Begin playback */
+	al_clr(r);
+	r->curorder = 0;
+	r->curpat = r->order[r->curorder];
+	r->patpos = r->patoff[r->curpat];
+	r->running = 1;
+	return 0;
+}
+
+/*
+ * rad_hz - How often rad_play should be called
+ */
+int rad_hz(const struct rad *r)
+{
+	return r->slow ? 18 : 50;
+}
+
+/*
+ * rad_stop - Silence the OPL
+ */
+void rad_stop(struct rad *r)
+{
+	al_clr(r);
+	r->running = 0;
+}
+
+/*
+ * Playback routine
+ *
+ * Call at 50 or 18.2Hz intervals (depending on fast/slow)
+ */
+void rad_play(struct rad *r)
+{
+	const uint8_t *data = r->data;
+	uint8_t line, chan, note[2];
+	uint8_t oct, n, inst, cmd, param;
+	int nextline;
+
+	/* Check for done flag */
+	if (r->patpos == 0xFFFF) {
+		if (r->running)
+			rad_stop(r);
+		return;
+	}
+
+	/*
+	 * Read a new line if the count is up
+	 */
+	if (r->spdcnt-- == 0) {
+
+		for (chan = 0; chan < RAD_CHANS; chan++) {
+			r->effects[chan].portslide = 0;
+			r->effects[chan].toneslide = 0;
+			r->effects[chan].volslide = 0;
+		}
+
+		line = data[r->patpos]; /* Read in line number */
+		/*
+		 * If the next line read matches the current line number,
+		 * ie. We've already handled any blank lines
+		 */
+		if (r->curline++ == (line&0x7F)) {
+			r->patpos++;
+			do {
+				/*
+				 * Read all the channel changes in this line
+				 */
+				chan = data[r->patpos++];
+
+				note[0] = data[r->patpos++];
+				note[1] = data[r->patpos++];
+
+				/*
+				 * Check for a command, if so read the parameter
+				 */
+				param = 0;
+				if (note[1] & 0xF)
+					param = data[r->patpos++];
+				cmd = note[1] & 0xF;
+
+				/*
+				 * Extract note data from note packet
+				 */
+				oct = (note[0] >> 4) & 0x7;
+				n = note[0] & 0xF;
+				inst = (note[1]>>4) | ((note[0]&0x80)>>3);
+
+				if ((chan&0x7F) < RAD_CHANS
+				    && (nextline = do_note(r, chan&0x7F, oct, n, cmd, param,
+				                           inst)) > 0) {
+					/*
+					 * Jump to line nextline-1 in next pattern, ignore
+					 * remaining channels on this line
+					 */
+					r->curpat = r->order[++r->curorder];
+					/*
+					 * Check if the next pattern is to be a jump instad
+					 */
+					while (r->curpat & 0x80) {
+						r->curorder = r->curpat - 0x80;
+						r->curpat = r->order[r->curorder];
+					}
+
+					/* Get the offset for the selected pattern */
+					r->patpos = r->patoff[r->curpat];
+
+					/* Go through pattern till we find matching line */
+					while ((data[r->patpos] & 0x7F) < nextline) {
+						if (data[r->patpos] & 0x80) {
+							/* End of pattern searching for line
+							 * Stop playback
+							 */
+							r->patpos = 0xFFFF;
+							break;
+						}
+						/* Skip line */
+						r->patpos++;
+						while (!(data[r->patpos++] & 0x80)) {
+							r->patpos++; /* Skip note[0] */
+							if (data[r->patpos++] & 0xF) /* Skip note[1] */
+								r->patpos++; /* Skip parameter */
+						}
+					}
+					r->curline = nextline;
+					goto skip;
+				}
+
+			} while (!(chan & 0x80));
+		}
+
+		/*
+		 * Check if we hit the end of a pattern
+		 */
+		if ((line & 0x80) || (r->curline >= 0x80)) {
+			r->curpat = r->order[++r->curorder];
+			/*
+			 * Check if the next pattern is to be a jump instad
+			 */
+			while (r->curpat & 0x80) {
+				r->curorder = r->curpat - 0x80;
+				r->curpat = r->order[r->curorder];
+			}
+
+			/* Get the offset for the selected pattern */
+			r->patpos = r->patoff[r->curpat];
+			r->curline = 0;
+		}
+
+		/*
+		 * Reset spdcnt to current speed
+		 */
+skip:
+		r->spdcnt = r->speed-1;
+	}
+
+	/* Update effects for the line */
+	doeffects(r);
+
+}
+
+static void doeffects(struct rad *r)
+{
+	uint8_t chan;
+	short lfreq;
+	short vol;
+
+	for (chan = 0; chan < RAD_CHANS; chan++) {
+		if (r->effects[chan].portslide) {
+			lfreq = get_linear_freq(r, chan);
+
+			lfreq += (short)(r->effects[chan].portslide);
+
+			set_linear_freq(r, chan, lfreq);
+		}
+		if (r->effects[chan].toneslide) {
+			lfreq = get_linear_freq(r, chan);
+			if (lfreq < r->toneslide_freq[chan]) {
+				lfreq += r->toneslide_speed[chan];
+				if (lfreq >= r->toneslide_freq[chan]) {
+					r->effects[chan].toneslide = 0;
+					lfreq = r->toneslide_freq[chan];
+				}
+			} else if (lfreq > r->toneslide_freq[chan]) {
+				lfreq -= r->toneslide_speed[chan];
+				if (lfreq <= r->toneslide_freq[chan]) {
+					r->effects[chan].toneslide = 0;
+					lfreq = r->toneslide_freq[chan];
+				}
+			} else {
+				r->effects[chan].toneslide = 0;
+			}
+			set_linear_freq(r, chan, lfreq);
+		}
+		if (r->effects[chan].volslide) {
+			vol = get_volume(r, chan);
+			vol += r->effects[chan].volslide;
+			if (vol < 0)
+				vol = 0;
+			set_volume(r, chan, vol);
+		}
+	}
+}
+
+static int do_note(struct rad *r, uint8_t chan, uint8_t oct, uint8_t note,
+                   uint8_t cmd, uint8_t param, uint8_t inst)
+{
+	/*
+	 * If there is a note change
+	 */
+	if (note) {
+		/*
+		 * Check if this is a toneslide + note
+		 */
+		if (cmd == CMD_TONESLIDE) {
+			/*
+			 * oct+note is the destination frequency
+			 */
+			r->toneslide_freq[chan] = linearfreq(oct, note);
+			/* If param != 0 then change the speed */
+			if (param)
+				r->toneslide_speed[chan] = param;
+
+			r->effects[chan].toneslide = 1;
+			return 0;
+
+		} else {
+			/* Set note (or KEY-OFF) */
+			set_note(r, chan, oct, 15); /*KEY-OFF*/
+			/*
+			 * Change instrument for channel
+			 */
+			if (inst)
+				load_inst(r, inst-1, chan);
+			set_note(r, chan, oct, note);
+		}
+	}
+
+	/*
+	 * Handle any commands
+	 */
+	switch(cmd) {
+	case CMD_PORTUP:       /* Portamento Up */
+		r->effects[chan].portslide = (int8_t)param;
+		break;
+
+	case CMD_PORTDN:       /* Portamento Down */
+		r->effects[chan].portslide = -(int8_t)param;
+		break;
+
+	case CMD_TONESLIDE:    /* Slide tone (no note specified) */
+		r->effects[chan].toneslide = 1;
+		if (param)
+			r->toneslide_speed[chan] = param;
+		break;
+
+	case CMD_TONEVOLSLIDE: /* Slide tone and volume */
+		r->effects[chan].toneslide = 1;
+		/* Fall through */
+	case CMD_VOLSLIDE:     /* Volume slide (Down < 50, Up > 50) */
+		r->effects[chan].volslide = (param < 50) ? -param : param - 50;
+		break;
+
+	case CMD_SETVOL:       /* Set volume for channel */
+		set_volume(r, chan, param);
+		break;
+
+	case CMD_JMPLINE:      /* Jump to line in next pattern */
+		return 1+param;
+
+	case CMD_SETSPEED:	   /* Set playback speed */
+		r->speed = param;
+		break;
+	}
+	return 0;
+}
+
+static void set_note(struct rad *r, uint8_t chan, uint8_t oct, uint8_t note)
+{
+	uint16_t freq;
+
+	if (!note)
+		return;
+
+	if (note < 13) {
+		freq = 0x2000 | (((uint16_t)oct << 10) + notefreq[note-1]);
+		r->prev_freqlow[chan] = (uint8_t)freq;
+		r->prev_freqhigh[chan] = (uint8_t)(freq >> 8);
+
+		al_write(r, 0xA0 + chan, (uint8_t)freq);
+		al_write(r, 0xB0 + chan, (uint8_t)(freq >> 8));
+	}
+	else {
+		/* KEY-OFF */
+		r->prev_freqhigh[chan] &= ~0x20;
+		al_write(r, 0xB0 + chan, r->prev_freqhigh[chan]);
+	}
+}
+
+/* Set frequency of channel from a linear freq */
+static void set_linear_freq(struct rad *r, uint8_t chan, short lfreq)
+{
+	uint8_t oct;
+	uint16_t nfreq;
+	uint16_t freq;
+
+	oct = lfreq / OCTAVE;
+	nfreq = (lfreq % OCTAVE) + NOTE_C;
+
+	/* Mask out old frequency */
+	freq = (r->prev_freqhigh[chan] & ~0x1F) << 8;
+	freq |= nfreq;
+	freq |= (uint16_t)oct << 10;
+
+	r->prev_freqlow[chan] = (uint8_t)freq;
+	r->prev_freqhigh[chan] = (uint8_t)(freq >> 8);
+
+	al_write(r, 0xA0 + chan, (uint8_t)freq);
+	al_write(r, 0xB0 + chan, (uint8_t)(freq >> 8));
+
+}
+
+/* Get frequency of channel as a linear freq */
+static short get_linear_freq(struct rad *r, uint8_t chan)
+{
+	uint16_t freq, nfreq;
+	uint8_t oct;
+
+	freq = (uint16_t)r->prev_freqlow[chan]
+	       | ((uint16_t)r->prev_freqhigh[chan] << 8);
+
+	oct = (freq >> 10) & 0x7;
+	nfreq = freq & 0x3FF;
+
+	return linearfreq2(oct, nfreq);
+}
+
+/* Set volume for specified channel */
+static void set_volume(struct rad *r, uint8_t chan, uint8_t vol)
+{
+	uint8_t new43;
+	uint8_t choff = al_choff[chan];
+
+	if (vol >= 64)
+		vol = 63;
+
+	new43 = r->prev_vol[chan] & ~0x3f;  /* Mask out old volume */
+	new43 |= vol ^ 0x3F;                /* Invert volume */
+
+	r->prev_vol[chan] = new43;
+	al_write(r, 0x43+choff, new43);
+}
+
+/* Get volume for specified channel */
+static uint8_t get_volume(struct rad *r, uint8_t chan)
+{
+	uint8_t vol;
+
+	vol = r->prev_vol[chan] & 0x3F;
+	vol ^= 0x3F;
+
+	return vol;
+}
+
+/* Load instrument i into OPL channel chan */
+static void load_inst(struct rad *r, uint8_t i, uint8_t chan)
+{
+	const struct rad_inst *in = &r->insts[i];
+	uint8_t choff;
+	choff = al_choff[chan];
+
+	al_write(r, 0x23+choff, in->r23);
+	al_write(r, 0x20+choff, in->r20);
+	al_write(r, 0x43+choff, in->r43);
+	r->prev_vol[chan] = in->r43;
+	al_write(r, 0x40+choff, in->r40);
+	al_write(r, 0x63+choff, in->r63);
+	al_write(r, 0x60+choff, in->r60);
+	al_write(r, 0x83+choff, in->r83);
+	al_write(r, 0x80+choff, in->r80);
+	al_write(r, 0xE3+choff, in->rE3);
+	al_write(r, 0xE0+choff, in->rE0);
+	al_write(r, 0xC0+chan, in->rC0);
+}
+
+/* Reset adlib registers */
+static void al_clr(struct rad *r)
+{
+	for (int i = 0; i < 256; i++)
+		al_write(r, i, 0);
+}
@@ -0,0 +1,66 @@
+/* RAD - Reality Adlib Tracker playback
+ *
+ * The player from RADPLAY, minus the DOS. Instead of poking the Adlib ports
+ * from the timer interrupt, rad_play is called at rad_hz times a second and
+ * hands every OPL2 register write to a callback, which can feed an emulator
+ * or real hardware, or nothing at all.
+ *
+ * Only version 1.0 RAD files are supported.
+ */
+#ifndef RAD_H
+#define RAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RAD_CHANS   9
+
+typedef void (*rad_opl)(void *ud, uint8_t reg, uint8_t val);
+
+/* Instrument table, names are adlib base registers */
+struct rad_inst {
+	uint8_t r23, r20, r43, r40, r63, r60, r83, r80, rC0, rE3, rE0;
+};
+
+struct rad {
+	rad_opl opl;
+	void *ud;
+
+	const uint8_t *data;        // Pattern/note data
+	size_t datalen;
+	struct rad_inst insts[31];
+	uint16_t patoff[32];        // Offsets of patterns in data
+	uint8_t order[128];         // Patterns to play, val > 80h = jump
+	uint8_t orderlen;
+	uint8_t curorder;
+	uint8_t curpat;
+	uint8_t curline;
+	uint16_t patpos;            // Offset into data, 0xFFFF when done
+
+	uint8_t speed;              // Ticks per line
+	uint8_t spdcnt;             // Countdown between lines
+	uint8_t slow;               // 18.2Hz rather than 50Hz
+	int running;
+
+	/* Previous OPL register values for effects, since we can't read back */
+	uint8_t prev_vol[RAD_CHANS];        // OPL 43h
+	uint8_t prev_freqlow[RAD_CHANS];    // OPL A0h
+	uint8_t prev_freqhigh[RAD_CHANS];   // OPL B0h
+
+	/* Effect/Command parameters */
+	uint8_t toneslide_speed[RAD_CHANS];
+	uint16_t toneslide_freq[RAD_CHANS];
+	struct {
+		int8_t portslide;
+		uint8_t toneslide;
+		int8_t volslide;
+	} effects[RAD_CHANS];
+};
+
+int rad_load(struct rad *r, const uint8_t *song, size_t len, rad_opl opl,
+             void *ud);
+void rad_play(struct rad *r);
+void rad_stop(struct rad *r);
+int rad_hz(const struct rad *r);
+
+#endif
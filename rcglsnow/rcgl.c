@@ -32,44 +32,62 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  ******************************************************************************/
 
 #include "rcgl.h"
+#include "rcglint.h"
+#include "rcmetrics.h"
 #include <SDL2/SDL.h>
+#include <errno.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 
 /* LIBRARY STATE */
-static SDL_Window *wind;
-static SDL_Renderer *rend;
-static SDL_Texture *tx;
-static SDL_Thread *thread;
 
-static SDL_cond *initcond;
-static SDL_cond *waitdrawcond;
-static SDL_mutex *mutex;
-static int initstatus;
-static int drawstatus;
+/* One event thread serves every context, SDL wants events and rendering
+ * kept to a single thread. It is started with the first context and stops
+ * once the last one is destroyed. Contexts must be created and destroyed
+ * from one thread, after that each may be driven from its own. */
+#define MAXCTX 16
+
+static SDL_Thread *thread;
+static SDL_sem *ready;                 // Posted once the event thread is up
+static int threadstatus;
+static int nctx;                       // Contexts using the event thread
 
-static SDL_atomic_t status;
+static struct rcgl_ctx *ctxs[MAXCTX];  // Open windows, event thread only
+static int nopen;
 
 static uint32_t EVENT_TERM;
 static uint32_t EVENT_REDRAW;
-
+static uint32_t EVENT_OPEN;
+static uint32_t EVENT_CLOSE;
+
+/* Frame pacing. clock_nanosleep can wake late by a lot more than the spin
+ * margin on a busy system, the margin tracks how late it has been waking. */
+#define SPIN_MIN    50000       // ns, least time left to spin
+#define SPIN_MAX    4000000
+static SDL_atomic_t spinmargin = { 500000 };
+
+/* Counters for rcmetrics, summed over every context. Registered with the
+ * first context, nothing is counted before then. */
+static int m_updates = -1, m_coalesced = -1, m_presents = -1, m_stalls = -1;
+static int m_evdropped = -1;
+static int m_compose = -1, m_upload = -1, m_present = -1;
+
+/* Default context behind the rcgl_* calls without a context argument */
 uint32_t rcgl_palette[256];
-static int bw;                  // Buffer width
-static int bh;                  // Buffer height
-static uint8_t *buf;                   // Pointer to user buffer
-static uint8_t *ibuf;                  // Internal/Default user buffer
-static int running;				// Is the video thread still alive
-
-static struct CARGS {
-	int w, h, ww, wh;
-	const char *title;
-	int wflags;
-} cargs;
+static struct rcgl_ctx defctx;
+static struct rcgl_ctx *dctx;
 
 
 /* Internal prototypes */
-static void blit(uint8_t *src, uint32_t *dst);
+static int ctxopen(struct rcgl_ctx *c, int w, int h, int ww, int wh,
+                   const char *title, int wflags, uint32_t *pal);
+static void ctxclose(struct rcgl_ctx *c);
+static int compose(struct rcgl_ctx *c, SDL_Rect *r);
+static void input(const SDL_Event *e);
 static int videothread(void *data);
 
 
@@ -88,147 +106,120 @@ static int videothread(void *data);
  * title - title
  * sc - integer pixel scale (window size is w*sc by h*sc)
  * wflags:  1 = RESIZABLE, 2 = FULLSCREEN, 4 = MAXIMIZED,
- *          8 = FULLSCREEN_NATIVE, 16 = INTEGER SCALING
+ *          8 = FULLSCREEN_NATIVE, 16 = INTEGER SCALING, 32 = VSYNC,
+ *          64 = HIDDEN
+ *
+ * Opens the default context used by the calls without a context argument.
  */
 int rcgl_init(int w, int h, int ww, int wh, const char *title, int wflags)
 {
-	int rval = 0;
-	int istat;
-
-	bw = w;
-	bh = h;
-
-	cargs.w = w;
-	cargs.h = h;
-	cargs.ww = ww;
-	cargs.wh = wh;
-	cargs.title = title;
-	cargs.wflags = wflags;
-
-	// Create internal framebuffer
-	if ((ibuf = calloc(w*h, sizeof(uint8_t))) == NULL) {
-		fprintf(stderr, "RCGL: Failed to allocate internal framebuffer\n");
-		rval = -1;
-		goto failalloc;
-	}
-	buf = ibuf;
-
-	// Set default palette
-	rcgl_setpalette(RCGL_PALETTE_VGA);
+	int rval;
 
-	mutex = SDL_CreateMutex();
-	if (mutex == NULL) {
-		fprintf(stderr, "RCGL: Failed to create mutex\n");
-		rval = -2;
-		goto failmutex;
-	}
-	initcond = SDL_CreateCond();
-	if (initcond == NULL) {
-		fprintf(stderr, "RCGL: Failed to create init condition variable\n");
-		rval = -2;
-		goto failcond;
-	}
-	waitdrawcond = SDL_CreateCond();
-	if (waitdrawcond == NULL) {
-		fprintf(stderr, "RCGL: Failed to create wdraw condition variable\n");
-		rval = -2;
-		goto failcond2;
-	}
+	if ((rval = ctxopen(&defctx, w, h, ww, wh, title, wflags,
+	                    rcgl_palette)) == 0)
+		dctx = &defctx;
+	return rval;
+}
 
-	// Create user defined events
-	EVENT_TERM = SDL_RegisterEvents(2);
-	if (EVENT_TERM == (uint32_t)-1) {
-		fprintf(stderr, "RCGL: Failed to create user events\n");
-		rval = -2;
-		goto failevent;
-	}
-	EVENT_REDRAW = EVENT_TERM+1;
+/*
+ * rcgl_quit - Terminate program manually
+ */
+void rcgl_quit(void)
+{
+	if (dctx == NULL)
+		return;
+	ctxclose(dctx);
+	dctx = NULL;
+}
 
-	
-	
-	// Start-up video thread
-	thread = SDL_CreateThread(videothread, "RCGLWindowThread", NULL);
-	if (thread == NULL) {
-		fprintf(stderr, "RCGL: Failed to create RCGLWindowThread: %s\n",
-		        SDL_GetError());
-		rval = -3;
-		goto failthread;
-	}
+/*
+ * rcgl_create - Open another window with its own buffer, palette and layers
+ *
+ * Takes the same arguments as rcgl_init. Every context is drawn and updated
+ * independently, through the rcgl_ctx_* versions of the calls.
+ *
+ * Returns NULL on failure.
+ */
+struct rcgl_ctx *rcgl_create(int w, int h, int ww, int wh, const char *title,
+                             int wflags)
+{
+	struct rcgl_ctx *c;
 
-	// Block till video thread has been initialized, or till an error occurs
-	SDL_LockMutex(mutex);
-	while (!initstatus) {
-		SDL_CondWait(initcond, mutex);
+	if ((c = calloc(1, sizeof(*c))) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate context\n");
+		return NULL;
 	}
-	istat = initstatus;
-	SDL_UnlockMutex(mutex);
-	if (istat < 0) { // Failure to init
-		fprintf(stderr, "RCGL: Error intializing in video thread\n");
-		SDL_WaitThread(thread, &rval);
-		goto failthread;
+	if (ctxopen(c, w, h, ww, wh, title, wflags, c->palette) < 0) {
+		free(c);
+		return NULL;
 	}
-	// Otherwise video thread has been launched successfully
-	// Clear the screen
-	rcgl_update();
-	
-	return rval;
-	// Failure path
-failthread:
-failevent:
-	SDL_DestroyCond(waitdrawcond);
-failcond2:
-	SDL_DestroyCond(initcond);
-failcond:
-	SDL_DestroyMutex(mutex);
-failmutex:
-	free(ibuf);
-	ibuf = NULL;
-	buf = NULL;
-failalloc:
-	return rval;
+	return c;
 }
 
 /*
- * rcgl_quit - Terminate program manually
+ * rcgl_destroy - Close a context's window and free it
  */
-void rcgl_quit(void)
+void rcgl_destroy(struct rcgl_ctx *c)
 {
-	int rval = 0;
-	// Signal to video thread to close down shop
-	SDL_Event event;
-	SDL_zero(event);
-	event.type = EVENT_TERM;
-	SDL_PushEvent(&event);
-
-	// Wait for video thread to quit
-	SDL_WaitThread(thread, &rval);
-	
-	// Finally destroy our buffer
-	if (ibuf)
-		free(ibuf);
-	ibuf = NULL;
+	ctxclose(c);
+	free(c);
 }
 
 /*
  * rcgl_update - Render buffer to screen
+ *
+ * The frame is composited before returning, so the buffer and layers are
+ * free to change straight away, but it is put on screen by the event thread
+ * afterwards. Updates made while one is still waiting for the event thread
+ * are merged into it and only the latest frame is shown.
+ *
+ * Returns 0 if the last frame shown could not be uploaded, 1 otherwise.
  */
-int rcgl_update(void)
+int rcgl_ctx_update(struct rcgl_ctx *c)
 {
-	void *rbuf;
 	int rval = 0;
+	SDL_Rect r;
+	int changed, palchanged;
+	uint64_t t;
 	
 
 	SDL_Event event;
 	SDL_zero(event);
 	event.type = EVENT_REDRAW;
-	SDL_PushEvent(&event);
-
-	// Wait for thread to draw changes before returning
-	SDL_LockMutex(mutex);
-	SDL_CondWait(waitdrawcond, mutex);
+	event.user.data1 = c;
+
+	SDL_LockMutex(c->mutex);
+	palchanged = c->paldirty;
+	if (c->shm)
+		shm_begin(c->shm);
+	t = rcgl_now_ns();
+	changed = compose(c, &r);
+	rcmetrics_add(m_compose, rcgl_now_ns() - t);
+	if (c->shm)
+		shm_end(c->shm, changed ? r.y : 0, changed ? r.y + r.h : 0,
+		        c->pal, palchanged);
+	// Gather changed rows until the event thread picks them up
+	if (changed) {
+		if (r.y < c->up0)
+			c->up0 = r.y;
+		if (r.y + r.h > c->up1)
+			c->up1 = r.y + r.h;
+	}
+	c->stats.updates++;
+	rcmetrics_add(m_updates, 1);
+	if (c->pending) {
+		c->stats.coalesced++;
+		rcmetrics_add(m_coalesced, 1);
+	} else {
+		// If the queue is full the rows stay gathered for the next try
+		c->pending = SDL_PushEvent(&event) > 0;
+	}
+	rval = c->drawstatus;
+	SDL_UnlockMutex(c->mutex);
 
-	rval = drawstatus;
-	SDL_UnlockMutex(mutex);
+	// The composite stays put until the next update, snapshot it
+	if (c->rec)
+		rec_frame(c->rec, c->cbuf, c->pal, SDL_GetTicks());
 
 	return rval;
 }
@@ -237,38 +228,126 @@ int rcgl_update(void)
  * rcgl_setbuf - Change buffer to b
  * If b is NULL, set buffer to internal buffer
  */
-void rcgl_setbuf(uint8_t *b)
+void rcgl_ctx_setbuf(struct rcgl_ctx *c, uint8_t *b)
 {
 	if (b)
-		buf = b;
+		c->buf = b;
 	else
-		buf = ibuf;
+		c->buf = c->ibuf;
+	rcgl_ctx_dirty(c, 0, 0, c->bh);
 }
 
 /*
  * rcgl_getbuf - Get pointer to the current buffer
  */
-uint8_t *rcgl_getbuf(void)
+uint8_t *rcgl_ctx_getbuf(struct rcgl_ctx *c)
 {
-	return buf;
+	return c->buf;
 }
 
 /*
  * rcgl_hasquit - Test if program has quit
  */
-int rcgl_hasquit(void)
+int rcgl_ctx_hasquit(struct rcgl_ctx *c)
 {
-	return SDL_AtomicGet(&status) == 0;
+	return SDL_AtomicGet(&c->status) == 0;
 }
 
 /*
  * rcgl_delay - Delay for ms milliseconds
+ *
+ * A plain sleep, for idling. Pace frames with rcgl_wait_until, which spins
+ * for the last stretch to wake on time.
  */
 void rcgl_delay(uint32_t ms)
 {
 	SDL_Delay(ms);
 }
 
+/*
+ * rcgl_now_ns - Monotonic time in nanoseconds, for rcgl_wait_until
+ */
+uint64_t rcgl_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ull + ts.tv_nsec;
+}
+
+/*
+ * rcgl_wait_until - Return as close as possible to time ns (rcgl_now_ns)
+ *
+ * Sleeps for most of the wait and spins for the last stretch, which is
+ * sized from how late the sleeps have been waking up.
+ */
+void rcgl_wait_until(uint64_t ns)
+{
+	struct timespec ts;
+	uint64_t now = rcgl_now_ns(), target, late;
+	int margin = SDL_AtomicGet(&spinmargin);
+
+	if (ns > now + margin) {
+		target = ns - margin;
+		ts.tv_sec = target / 1000000000ull;
+		ts.tv_nsec = target % 1000000000ull;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL)
+		       == EINTR)
+			;
+		// Rise at once on a late wakeup, decay slowly otherwise
+		now = rcgl_now_ns();
+		late = now > target ? now - target : 0;
+		if (late > SPIN_MAX)    // Suspended or stopped, keep it in an int
+			late = SPIN_MAX;
+		if (late + SPIN_MIN > (uint64_t)margin)
+			margin = late + SPIN_MIN;
+		else
+			margin -= (margin - (late + SPIN_MIN)) / 16;
+		if (margin > SPIN_MAX)
+			margin = SPIN_MAX;
+		SDL_AtomicSet(&spinmargin, margin);
+	}
+	while (now < ns) {
+		sched_yield();
+		now = rcgl_now_ns();
+	}
+}
+
+/*
+ * rcgl_stats - Get counters for a context's display
+ */
+void rcgl_ctx_stats(struct rcgl_ctx *c, struct rcgl_stats *st)
+{
+	SDL_LockMutex(c->mutex);
+	*st = c->stats;
+	SDL_UnlockMutex(c->mutex);
+	st->events_dropped = SDL_AtomicGet(&c->evdropped);
+}
+
+/*
+ * rcgl_next_vsync - Predict when the display will next refresh
+ *
+ * Returns the time (rcgl_now_ns) of the next vertical blank after now and
+ * sets period to the refresh period, if not NULL. Predictions come from the
+ * times updates were presented, so they are only good with RCGL_VSYNC.
+ * Waiting until a little before it and then updating keeps frames evenly
+ * spaced without queueing up behind the display.
+ */
+uint64_t rcgl_ctx_next_vsync(struct rcgl_ctx *c, uint64_t *period)
+{
+	uint64_t now = rcgl_now_ns(), last, per;
+
+	SDL_LockMutex(c->mutex);
+	last = c->vsync;
+	per = c->period;
+	SDL_UnlockMutex(c->mutex);
+	if (period)
+		*period = per;
+	if (last == 0 || last > now)
+		return now;
+	return last + ((now - last) / per + 1) * per;
+}
+
 /*
  * rcgl_ticks - Return number of milliseconds since start
  */
@@ -280,24 +359,123 @@ uint32_t rcgl_ticks(void)
 /*
  * rcgl_plot - Plot a pixel at x,y with colour c
  */
-void rcgl_plot(int x, int y, uint8_t c)
+void rcgl_ctx_plot(struct rcgl_ctx *ctx, int x, int y, uint8_t c)
 {
-	buf[y * bw + x] = c;
+	ctx->buf[y * ctx->bw + x] = c;
 }
 
 /*
  * rcgl_setpalette - Copy an entire palette definition into the current palette
  */
-void rcgl_setpalette(const uint32_t palette[256])
+void rcgl_ctx_setpalette(struct rcgl_ctx *c, const uint32_t palette[256])
 {
 	for (int i = 0; i < 256; i++)
-		rcgl_palette[i] = palette[i];
+		c->pal[i] = palette[i];
+	c->paldirty = 1;
+}
+
+/*
+ * rcgl_newlayer - Add a layer on top of the existing ones
+ *
+ * RCGL_DENSE layers get their own cleared w*h buffer (see rcgl_getlayer),
+ * RCGL_SPARSE layers draw a list of points given with rcgl_setpoints.
+ * Index 0 is transparent in both. New layers start out visible with dirty
+ * tracking enabled, call rcgl_dirty after drawing into one.
+ *
+ * Returns the layer number, or -1 on failure.
+ */
+int rcgl_ctx_newlayer(struct rcgl_ctx *c, int type)
+{
+	struct LAYER *ly;
+
+	if (c->nlayers == RCGL_MAXLAYERS)
+		return -1;
+	ly = &c->layers[c->nlayers];
+	memset(ly, 0, sizeof(*ly));
+	if (type == RCGL_DENSE
+	    && (ly->buf = calloc(c->bw*c->bh, sizeof(uint8_t))) == NULL)
+		return -1;
+	ly->type = type;
+	ly->visible = 1;
+	ly->dirty1 = c->bh;
+	return c->nlayers++;
+}
+
+/*
+ * rcgl_getlayer - Get pointer to a dense layer's pixels, 0 is the buffer
+ */
+uint8_t *rcgl_ctx_getlayer(struct rcgl_ctx *c, int l)
+{
+	return l == 0 ? c->buf : c->layers[l].buf;
+}
+
+/*
+ * rcgl_showlayer - Show or hide a layer
+ */
+void rcgl_ctx_showlayer(struct rcgl_ctx *c, int l, int visible)
+{
+	c->layers[l].visible = visible;
+	rcgl_ctx_dirty(c, l, 0, c->bh);
+}
+
+/*
+ * rcgl_setautodirty - Redraw a layer in full on every update, or only the
+ * rows passed to rcgl_dirty
+ *
+ * Layer 0 is autodirty by default so programs that poke the buffer directly
+ * (or use rcgl_plot/rcgl_line/rcgl_blit) keep working. Turning it off is
+ * worthwhile when most of the screen is static.
+ */
+void rcgl_ctx_setautodirty(struct rcgl_ctx *c, int l, int on)
+{
+	c->layers[l].autodirty = on;
+}
+
+/*
+ * rcgl_dirty - Mark h rows of a layer starting at y as changed
+ *
+ * Only dirty rows are composited and palettized on the next update.
+ */
+void rcgl_ctx_dirty(struct rcgl_ctx *c, int l, int y, int h)
+{
+	struct LAYER *ly = &c->layers[l];
+	int y1 = y + h;
+
+	if (y < 0)
+		y = 0;
+	if (y1 > c->bh)
+		y1 = c->bh;
+	if (y >= y1)
+		return;
+	if (ly->dirty0 >= ly->dirty1) {
+		ly->dirty0 = y;
+		ly->dirty1 = y1;
+	} else {
+		if (y < ly->dirty0)
+			ly->dirty0 = y;
+		if (y1 > ly->dirty1)
+			ly->dirty1 = y1;
+	}
+}
+
+/*
+ * rcgl_setpoints - Set the points drawn by a sparse layer
+ *
+ * The array is read on each update until replaced, so it may be changed in
+ * place between updates. Rows are tracked automatically.
+ */
+void rcgl_ctx_setpoints(struct rcgl_ctx *c, int l, const struct rcgl_point *pts,
+                        int n)
+{
+	c->layers[l].pts = pts;
+	c->layers[l].npts = n;
 }
 
 /*
  * rcgl_line - Draw a line between two points
  */
-void rcgl_line(int x1, int y1, int x2, int y2, uint8_t c)
+void rcgl_ctx_line(struct rcgl_ctx *ctx, int x1, int y1, int x2, int y2,
+                   uint8_t c)
 {
 	// Bresenham's line drawing algorithm
 	int dx, dy;
@@ -308,25 +486,20 @@ void rcgl_line(int x1, int y1, int x2, int y2, uint8_t c)
 
 	dx = x2 - x1;
 	dy = y2 - y1;
-
 	// With the abs we can pretend to only be in octant 1 or 0
 	adx = abs(dx);
 	ady = abs(dy);
-
 	// Figure out the actual octant for the line
 	sdx = (dx > 0) ? 1 : (dx < 0) ? -1 : 0;
 	sdy = (dy > 0) ? 1 : (dy < 0) ? -1 : 0;
 
 	x = x1;
 	y = y1;
-
 	ex = 0;
 	ey = 0;
-
 	if (adx >= ady) { // Octant 0 (y rises slower than x)
 		for (int i = 0; i <= adx; i++) {
-			rcgl_plot(x, y, c);
-
+			rcgl_ctx_plot(ctx, x, y, c);
 			ey += ady;
 			if (ey >= adx) { // If we're past the increment point of y
 				ey -= adx;   // Reset, but propogate error
@@ -337,8 +510,7 @@ void rcgl_line(int x1, int y1, int x2, int y2, uint8_t c)
 	}
 	else { // Octant 1 (x rises slower than y)
 		for (int i = 0; i <= ady; i++) {
-			rcgl_plot(x, y, c);
-
+			rcgl_ctx_plot(ctx, x, y, c);
 			ex += adx;
 			if (ex >= ady) { // If we're past the increment point of x
 				ex -= ady;   // Reset, but propogate error
@@ -352,10 +524,11 @@ void rcgl_line(int x1, int y1, int x2, int y2, uint8_t c)
 /*
  * rcgl_blit - Blit a bitmap somewhere onto the framebuffer
  */
-void rcgl_blit(uint8_t *b, int x, int y, int w, int h, int trans, uint8_t *plt)
+void rcgl_ctx_blit(struct rcgl_ctx *ctx, uint8_t *b, int x, int y, int w, int h,
+                   int trans, uint8_t *plt)
 {
-	uint8_t *fb = buf + (y * bw) + x;
-
+	int bw = ctx->bw;
+	uint8_t *fb = ctx->buf + (y * bw) + x;
 	if (plt != NULL) {
 		for (int r = 0; r < h; r++) {
 			for (int c = 0; c < w; c++) {
@@ -380,251 +553,826 @@ void rcgl_blit(uint8_t *b, int x, int y, int w, int h, int trans, uint8_t *plt)
 	}
 }
 
+/*
+ * rcgl_poll_event - Take the next input event, without blocking
+ *
+ * Returns 1 and fills in ev if there was one, 0 if the queue is empty.
+ */
+int rcgl_ctx_poll_event(struct rcgl_ctx *c, struct rcgl_event *ev)
+{
+	unsigned tail = SDL_AtomicGet(&c->evtail);
+
+	if (tail == (unsigned)SDL_AtomicGet(&c->evhead))
+		return 0;
+	SDL_MemoryBarrierAcquire();
+	*ev = c->events[tail % NEVENTS];
+	SDL_AtomicSet(&c->evtail, tail + 1);
+	return 1;
+}
 
-/* INTERNAL LIBRARY HELPER ROUTINES */
+/*
+ * rcgl_key_down - Test if a key (RCGL_KEY_* / SDL scancode) is held down
+ */
+int rcgl_ctx_key_down(struct rcgl_ctx *c, int key)
+{
+	if (key < 0 || key >= RCGL_NKEYS)
+		return 0;
+	return (SDL_AtomicGet(&c->keys[key / 32]) >> (key % 32)) & 1;
+}
 
 /*
- * blit - Render 8-bit bitmap to 32-bit bitmap using palette
+ * rcgl_record_start - Start capturing every update to a video file
+ *
+ * format is RCGL_REC_GIF or RCGL_REC_Y4M. Encoding runs on its own thread,
+ * each update only pays for copying the frame into a queue. A Y4M file has
+ * a frame per update and plays back at fps, the rate the caller updates
+ * at, GIF frames are timed as they come. Any recording already running is
+ * stopped first.
  */
-static void blit(uint8_t *src, uint32_t *dst)
+int rcgl_ctx_record_start(struct rcgl_ctx *c, const char *path, int format,
+                          int fps)
 {
-	for (int y = 0; y < bh; y++)
-		for (int x = 0; x < bw; x++)
-			*(dst++) = rcgl_palette[*(src++)] | 0xFF000000;
+	rcgl_ctx_record_stop(c);
+	c->rec = rec_start(path, format, c->bw, c->bh, fps);
+	return c->rec ? 0 : -1;
 }
 
 /*
- * Background and screen update handler
+ * rcgl_record_stop - Finish the recording
  *
- * NOTE: This is the only thread allowed to call WaitEvent/PollEvent/PumpEvents
- * Though to do so we need to move the SDL init code here :/
+ * Returns the number of frames dropped because the encoder fell behind, or
+ * -1 if the file could not be written.
  */
-static int videothread(void *data)
+int rcgl_ctx_record_stop(struct rcgl_ctx *c)
 {
 	int rval;
+
+	if (c->rec == NULL)
+		return 0;
+	rval = rec_stop(c->rec);
+	c->rec = NULL;
+	return rval;
+}
+
+/*
+ * rcgl_publish - Share every update with other processes
+ *
+ * From now on the context composites into the POSIX shared-memory object
+ * name (e.g. "/snow"), which viewers open with rcgl_shm_open. Call from the
+ * thread that updates the context. Any earlier segment is removed first.
+ */
+int rcgl_ctx_publish(struct rcgl_ctx *c, const char *name)
+{
+	uint8_t *pix;
+
+	rcgl_ctx_unpublish(c);
+	if ((c->shm = shm_create(name, c->bw, c->bh, &pix)) == NULL)
+		return -1;
+	memcpy(pix, c->cbuf, c->bw*c->bh);
+	free(c->cbuf);
+	c->cbuf = pix;
+	return 0;
+}
+
+/*
+ * rcgl_unpublish - Stop sharing updates and remove the segment
+ */
+void rcgl_ctx_unpublish(struct rcgl_ctx *c)
+{
+	uint8_t *cb;
+
+	if (c->shm == NULL)
+		return;
+	// Bring the composite back into our own memory
+	if ((cb = malloc(c->bw*c->bh)) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate composite buffer\n");
+		return;
+	}
+	memcpy(cb, c->cbuf, c->bw*c->bh);
+	c->cbuf = cb;
+	shm_destroy(c->shm);
+	c->shm = NULL;
+}
+
+
+/* DEFAULT CONTEXT WRAPPERS */
+
+int rcgl_update(void) { return rcgl_ctx_update(dctx); }
+void rcgl_setbuf(uint8_t *b) { rcgl_ctx_setbuf(dctx, b); }
+uint8_t *rcgl_getbuf(void) { return rcgl_ctx_getbuf(dctx); }
+int rcgl_hasquit(void) { return dctx == NULL || rcgl_ctx_hasquit(dctx); }
+void rcgl_plot(int x, int y, uint8_t c) { rcgl_ctx_plot(dctx, x, y, c); }
+void rcgl_setpalette(const uint32_t palette[256])
+{
+	if (dctx)
+		rcgl_ctx_setpalette(dctx, palette);
+	else // Before rcgl_init, it is copied in there
+		memcpy(rcgl_palette, palette, sizeof(rcgl_palette));
+}
+void rcgl_line(int x1, int y1, int x2, int y2, uint8_t c)
+{
+	rcgl_ctx_line(dctx, x1, y1, x2, y2, c);
+}
+void rcgl_blit(uint8_t *b, int x, int y, int w, int h, int trans, uint8_t *plt)
+{
+	rcgl_ctx_blit(dctx, b, x, y, w, h, trans, plt);
+}
+int rcgl_newlayer(int type) { return rcgl_ctx_newlayer(dctx, type); }
+uint8_t *rcgl_getlayer(int l) { return rcgl_ctx_getlayer(dctx, l); }
+void rcgl_showlayer(int l, int visible) { rcgl_ctx_showlayer(dctx, l, visible); }
+void rcgl_setautodirty(int l, int on) { rcgl_ctx_setautodirty(dctx, l, on); }
+void rcgl_dirty(int l, int y, int h) { rcgl_ctx_dirty(dctx, l, y, h); }
+void rcgl_setpoints(int l, const struct rcgl_point *pts, int n)
+{
+	rcgl_ctx_setpoints(dctx, l, pts, n);
+}
+int rcgl_poll_event(struct rcgl_event *ev) { return rcgl_ctx_poll_event(dctx, ev); }
+int rcgl_key_down(int key) { return rcgl_ctx_key_down(dctx, key); }
+int rcgl_record_start(const char *path, int format, int fps)
+{
+	return rcgl_ctx_record_start(dctx, path, format, fps);
+}
+int rcgl_record_stop(void) { return dctx ? rcgl_ctx_record_stop(dctx) : 0; }
+void rcgl_stats(struct rcgl_stats *st) { rcgl_ctx_stats(dctx, st); }
+uint64_t rcgl_next_vsync(uint64_t *period)
+{
+	return rcgl_ctx_next_vsync(dctx, period);
+}
+int rcgl_publish(const char *name) { return rcgl_ctx_publish(dctx, name); }
+void rcgl_unpublish(void) { rcgl_ctx_unpublish(dctx); }
+
+
+
+/* INTERNAL LIBRARY HELPER ROUTINES */
+
+/*
+ * startthread - Start the event thread for the first context
+ */
+static int startthread(void)
+{
+	if (nctx++ > 0)
+		return 0;
+
+	// Create user defined events, once per process
+	if (EVENT_TERM == 0) {
+		EVENT_TERM = SDL_RegisterEvents(4);
+		if (EVENT_TERM == (uint32_t)-1) {
+			fprintf(stderr, "RCGL: Failed to create user events\n");
+			EVENT_TERM = 0;
+			nctx = 0;
+			return -2;
+		}
+		EVENT_REDRAW = EVENT_TERM+1;
+		EVENT_OPEN = EVENT_TERM+2;
+		EVENT_CLOSE = EVENT_TERM+3;
+
+		m_updates = rcmetrics_new("rcgl_updates_total", RCMETRICS_COUNTER,
+		        "Frames handed to the display");
+		m_coalesced = rcmetrics_new("rcgl_coalesced_total",
+		        RCMETRICS_COUNTER,
+		        "Frames dropped, merged into a later present");
+		m_presents = rcmetrics_new("rcgl_presents_total", RCMETRICS_COUNTER,
+		        "Frames put on screen");
+		m_stalls = rcmetrics_new("rcgl_stalls_total", RCMETRICS_COUNTER,
+		        "Texture uploads that took over 1 ms");
+		m_evdropped = rcmetrics_new("rcgl_events_dropped_total",
+		        RCMETRICS_COUNTER, "Input events lost to a full queue");
+		m_compose = rcmetrics_new("rcgl_compose_seconds_total",
+		        RCMETRICS_SECONDS, "Compositing and palettizing layers");
+		m_upload = rcmetrics_new("rcgl_upload_seconds_total",
+		        RCMETRICS_SECONDS, "Uploading changed rows to textures");
+		m_present = rcmetrics_new("rcgl_present_seconds_total",
+		        RCMETRICS_SECONDS, "Presenting, scaled to the window");
+	}
+
+	if ((ready = SDL_CreateSemaphore(0)) == NULL) {
+		fprintf(stderr, "RCGL: Failed to create semaphore\n");
+		nctx = 0;
+		return -2;
+	}
+	thread = SDL_CreateThread(videothread, "RCGLWindowThread", NULL);
+	if (thread == NULL) {
+		fprintf(stderr, "RCGL: Failed to create RCGLWindowThread: %s\n",
+		        SDL_GetError());
+		SDL_DestroySemaphore(ready);
+		nctx = 0;
+		return -3;
+	}
+	SDL_SemWait(ready);
+	SDL_DestroySemaphore(ready);
+	if (threadstatus < 0) {
+		SDL_WaitThread(thread, NULL);
+		thread = NULL;
+		nctx = 0;
+		return threadstatus;
+	}
+	return 0;
+}
+
+/*
+ * stopthread - Stop the event thread once the last context is gone
+ */
+static void stopthread(void)
+{
 	SDL_Event event;
-	int pitch;
-	void *rbuf;
-	int dstatus;
 
-	/* Video initialization */
-	SDL_Init(SDL_INIT_VIDEO);
-	wind = SDL_CreateWindow(cargs.title,
+	if (--nctx > 0)
+		return;
+	// Signal to video thread to close down shop
+	SDL_zero(event);
+	event.type = EVENT_TERM;
+	SDL_PushEvent(&event);
+	SDL_WaitThread(thread, NULL);
+	thread = NULL;
+}
+
+/*
+ * ctxopen - Set up a context and have the event thread open its window
+ */
+static int ctxopen(struct rcgl_ctx *c, int w, int h, int ww, int wh,
+                   const char *title, int wflags, uint32_t *pal)
+{
+	int rval = 0;
+	int istat;
+	SDL_Event event;
+
+	memset(c, 0, sizeof(*c));
+	c->bw = w;
+	c->bh = h;
+	c->pal = pal;
+	c->up0 = h;
+	c->drawstatus = 1;
+
+	c->cargs.w = w;
+	c->cargs.h = h;
+	c->cargs.ww = ww;
+	c->cargs.wh = wh;
+	c->cargs.title = title;
+	c->cargs.wflags = wflags;
+
+	// Create internal framebuffer
+	if ((c->ibuf = calloc(w*h, sizeof(uint8_t))) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate internal framebuffer\n");
+		rval = -1;
+		goto failalloc;
+	}
+	c->buf = c->ibuf;
+
+	// Layer 0 is the user buffer, opaque and fully redrawn on every update
+	// unless the program opts in to dirty tracking
+	c->nlayers = 1;
+	c->layers[0].type = RCGL_DENSE;
+	c->layers[0].visible = 1;
+	c->layers[0].autodirty = 1;
+
+	c->cbuf = calloc(w*h, sizeof(uint8_t));
+	c->obuf = calloc(w*h, sizeof(uint32_t));
+	c->rowdirty = calloc(h, sizeof(uint8_t));
+	c->ptrows = calloc(h, sizeof(uint8_t));
+	if (!c->cbuf || !c->obuf || !c->rowdirty || !c->ptrows) {
+		fprintf(stderr, "RCGL: Failed to allocate composite buffers\n");
+		rval = -1;
+		goto failmutex;
+	}
+
+	// Set default palette
+	rcgl_ctx_setpalette(c, RCGL_PALETTE_VGA);
+
+	c->mutex = SDL_CreateMutex();
+	if (c->mutex == NULL) {
+		fprintf(stderr, "RCGL: Failed to create mutex\n");
+		rval = -2;
+		goto failmutex;
+	}
+	c->initcond = SDL_CreateCond();
+	if (c->initcond == NULL) {
+		fprintf(stderr, "RCGL: Failed to create init condition variable\n");
+		rval = -2;
+		goto failcond;
+	}
+
+	// Start-up video thread if this is the first context
+	if ((rval = startthread()) < 0)
+		goto failthread;
+
+	// Have it open our window
+	SDL_zero(event);
+	event.type = EVENT_OPEN;
+	event.user.data1 = c;
+	SDL_PushEvent(&event);
+
+	// Block till the window has been created, or till an error occurs
+	SDL_LockMutex(c->mutex);
+	while (!c->initstatus) {
+		SDL_CondWait(c->initcond, c->mutex);
+	}
+	istat = c->initstatus;
+	SDL_UnlockMutex(c->mutex);
+	if (istat < 0) { // Failure to init
+		fprintf(stderr, "RCGL: Error intializing in video thread\n");
+		rval = istat;
+		stopthread();
+		goto failthread;
+	}
+	// Otherwise the window is up
+	// Clear the screen
+	rcgl_ctx_update(c);
+	
+	return rval;
+	// Failure path
+failthread:
+	SDL_DestroyCond(c->initcond);
+failcond:
+	SDL_DestroyMutex(c->mutex);
+failmutex:
+	free(c->cbuf);
+	free(c->obuf);
+	free(c->rowdirty);
+	free(c->ptrows);
+	free(c->ibuf);
+	c->ibuf = NULL;
+	c->buf = NULL;
+failalloc:
+	return rval;
+}
+
+/*
+ * ctxclose - Close a context's window and free its buffers
+ */
+static void ctxclose(struct rcgl_ctx *c)
+{
+	SDL_Event event;
+
+	rcgl_ctx_record_stop(c);
+
+	// Have the event thread tear down the window
+	SDL_zero(event);
+	event.type = EVENT_CLOSE;
+	event.user.data1 = c;
+	SDL_PushEvent(&event);
+
+	SDL_LockMutex(c->mutex);
+	while (c->initstatus > 0) {
+		SDL_CondWait(c->initcond, c->mutex);
+	}
+	SDL_UnlockMutex(c->mutex);
+
+	stopthread();
+
+	// Finally destroy our buffers
+	for (int l = 1; l < c->nlayers; l++)
+		free(c->layers[l].buf);
+	memset(c->layers, 0, sizeof(c->layers));
+	c->nlayers = 0;
+	if (c->shm)
+		shm_destroy(c->shm); // cbuf lives in the segment
+	else
+		free(c->cbuf);
+	c->shm = NULL;
+	free(c->obuf);
+	free(c->rowdirty);
+	free(c->ptrows);
+	if (c->ibuf)
+		free(c->ibuf);
+	c->ibuf = NULL;
+	SDL_DestroyCond(c->initcond);
+	SDL_DestroyMutex(c->mutex);
+}
+
+/*
+ * winctx - Find the context owning a window
+ */
+static struct rcgl_ctx *winctx(uint32_t id)
+{
+	for (int i = 0; i < nopen; i++)
+		if (SDL_GetWindowID(ctxs[i]->wind) == id)
+			return ctxs[i];
+	return NULL;
+}
+
+/*
+ * pushevent - Queue an input event for the program, dropped if it is full
+ */
+static void pushevent(struct rcgl_ctx *c, int type, int key, int button,
+                      int x, int y)
+{
+	unsigned head = SDL_AtomicGet(&c->evhead);
+	struct rcgl_event *ev;
+
+	if (head - (unsigned)SDL_AtomicGet(&c->evtail) >= NEVENTS) {
+		SDL_AtomicAdd(&c->evdropped, 1);
+		rcmetrics_add(m_evdropped, 1);
+		return;
+	}
+	ev = &c->events[head % NEVENTS];
+	ev->type = type;
+	ev->key = key;
+	ev->button = button;
+	ev->x = x;
+	ev->y = y;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&c->evhead, head + 1);
+}
+
+/*
+ * input - Translate an SDL input event for its window, updating key state
+ *
+ * Only called from videothread, which is the only writer of keys[].
+ */
+static void input(const SDL_Event *e)
+{
+	struct rcgl_ctx *c;
+	int k, w;
+
+	switch (e->type) {
+	case SDL_KEYDOWN:
+	case SDL_KEYUP:
+		k = e->key.keysym.scancode;
+		if (k < 0 || k >= RCGL_NKEYS || !(c = winctx(e->key.windowID)))
+			break;
+		w = SDL_AtomicGet(&c->keys[k / 32]);
+		if (e->type == SDL_KEYDOWN)
+			w |= 1u << (k % 32);
+		else
+			w &= ~(1u << (k % 32));
+		SDL_AtomicSet(&c->keys[k / 32], w);
+		pushevent(c, e->type == SDL_KEYDOWN ? RCGL_KEYDOWN : RCGL_KEYUP,
+		          k, 0, 0, 0);
+		break;
+	case SDL_MOUSEMOTION:
+		if ((c = winctx(e->motion.windowID)))
+			pushevent(c, RCGL_MOUSEMOVE, 0, 0, e->motion.x, e->motion.y);
+		break;
+	case SDL_MOUSEBUTTONDOWN:
+	case SDL_MOUSEBUTTONUP:
+		if ((c = winctx(e->button.windowID)))
+			pushevent(c, e->type == SDL_MOUSEBUTTONDOWN
+			             ? RCGL_MOUSEDOWN : RCGL_MOUSEUP,
+			          0, e->button.button, e->button.x, e->button.y);
+		break;
+	case SDL_MOUSEWHEEL:
+		if ((c = winctx(e->wheel.windowID)))
+			pushevent(c, RCGL_MOUSEWHEEL, 0, 0, e->wheel.x, e->wheel.y);
+		break;
+	}
+}
+
+/*
+ * rcgl_blitrow - Render 8-bit row to 32-bit row using palette
+ */
+void rcgl_blitrow(const uint32_t *pal, const uint8_t *src, uint32_t *dst,
+                  int w)
+{
+	for (int x = 0; x < w; x++)
+		*(dst++) = pal[*(src++)] | 0xFF000000;
+}
+
+/*
+ * compose - Composite and palettize the dirty rows of all layers
+ *
+ * Rows are rebuilt in cbuf from the bottom layer up, then converted into
+ * obuf. r is set to the span of rows that changed, returns 0 if none did.
+ */
+static int compose(struct rcgl_ctx *c, SDL_Rect *r)
+{
+	int bw = c->bw, bh = c->bh;
+	uint8_t *rowdirty = c->rowdirty, *ptrows = c->ptrows;
+	int y0 = bh, y1 = 0;
+	int all = c->paldirty;
+
+	// Gather dirty rows from every layer
+	for (int l = 0; l < c->nlayers; l++) {
+		struct LAYER *ly = &c->layers[l];
+		if (ly->autodirty)
+			all = 1;
+		if (all)
+			continue;
+		for (int y = ly->dirty0; y < ly->dirty1; y++)
+			rowdirty[y] = 1;
+		if (ly->type == RCGL_SPARSE && ly->visible)
+			for (int i = 0; i < ly->npts; i++)
+				rowdirty[ly->pts[i].y] = 1;
+	}
+	// Rows that held points last time need restoring too
+	for (int y = 0; y < bh; y++) {
+		if (all || ptrows[y])
+			rowdirty[y] = 1;
+		ptrows[y] = 0;
+	}
+	c->paldirty = 0;
+
+	for (int y = 0; y < bh; y++) {
+		uint8_t *cb;
+		if (!rowdirty[y])
+			continue;
+		if (y < y0)
+			y0 = y;
+		y1 = y+1;
+		cb = c->cbuf + y*bw;
+		memcpy(cb, c->buf + y*bw, bw);
+		for (int l = 1; l < c->nlayers; l++) {
+			const uint8_t *s = c->layers[l].buf + y*bw;
+			if (c->layers[l].type != RCGL_DENSE || !c->layers[l].visible)
+				continue;
+			for (int x = 0; x < bw; x++)
+				if (s[x])
+					cb[x] = s[x];
+		}
+	}
+	// Points go on top, only rows being redrawn need them
+	for (int l = 1; l < c->nlayers; l++) {
+		struct LAYER *ly = &c->layers[l];
+		if (ly->type != RCGL_SPARSE || !ly->visible)
+			continue;
+		for (int i = 0; i < ly->npts; i++) {
+			const struct rcgl_point *p = &ly->pts[i];
+			if (p->c && rowdirty[p->y]) {
+				c->cbuf[p->y*bw + p->x] = p->c;
+				ptrows[p->y] = 1;
+			}
+		}
+	}
+	for (int y = y0; y < y1; y++) {
+		if (rowdirty[y])
+			rcgl_blitrow(c->pal, c->cbuf + y*bw, c->obuf + y*bw, bw);
+		rowdirty[y] = 0;
+	}
+	for (int l = 0; l < c->nlayers; l++)
+		c->layers[l].dirty0 = c->layers[l].dirty1 = 0;
+
+	r->x = 0;
+	r->y = y0;
+	r->w = bw;
+	r->h = y1 - y0;
+	return y0 < y1;
+}
+
+/*
+ * present - Show a context's texture, scaled to its window
+ *
+ * With vsync each present returns just after a vertical blank, so the gaps
+ * between them refine the refresh period. Gaps that are not close to a
+ * whole number of periods (late frames, the window being dragged) are
+ * ignored.
+ */
+static void present(struct rcgl_ctx *c)
+{
+	uint64_t now, dt, n, t;
+
+	t = rcgl_now_ns();
+	SDL_SetRenderDrawColor(c->rend, 0, 0, 0, 0);
+	SDL_RenderClear(c->rend);
+	SDL_RenderCopy(c->rend, c->tx[c->curtx], NULL, NULL); // Render texture to entire window
+	SDL_RenderPresent(c->rend);                 // Do update
+
+	now = rcgl_now_ns();
+	rcmetrics_add(m_present, now - t);
+	SDL_LockMutex(c->mutex);
+	if (c->vsync) {
+		dt = now - c->vsync;
+		n = (dt + c->period/2) / c->period;
+		if (n >= 1 && n <= 4 && dt + c->period/8 > n*c->period
+		    && dt < n*c->period + c->period/8)
+			c->period = (c->period*15 + dt/n) / 16;
+	}
+	c->vsync = now;
+	SDL_UnlockMutex(c->mutex);
+}
+
+/*
+ * redraw - Upload a context's changed rows and present them
+ */
+static void redraw(struct rcgl_ctx *c)
+{
+	SDL_Rect r;
+	uint64_t t;
+	int t0, t1;
+
+	SDL_LockMutex(c->mutex);
+	c->pending = 0;
+	// Every texture is now missing the rows changed since the last redraw
+	for (int i = 0; i < NTEX; i++) {
+		if (c->up0 < c->stale0[i])
+			c->stale0[i] = c->up0;
+		if (c->up1 > c->stale1[i])
+			c->stale1[i] = c->up1;
+	}
+	c->up0 = c->bh;
+	c->up1 = 0;
+	// Upload into the next texture, the last one may still be in use by
+	// the driver for the previous present
+	if (c->stale0[c->curtx] < c->stale1[c->curtx]) {
+		c->curtx = (c->curtx + 1) % NTEX;
+		t0 = c->stale0[c->curtx];
+		t1 = c->stale1[c->curtx];
+		r.x = 0;
+		r.y = t0;
+		r.w = c->bw;
+		r.h = t1 - t0;
+		t = rcgl_now_ns();
+		c->drawstatus = SDL_UpdateTexture(c->tx[c->curtx], &r,
+		                                  c->obuf + t0*c->bw, c->bw*4) == 0;
+		t = rcgl_now_ns() - t;
+		rcmetrics_add(m_upload, t);
+		if (t > STALL_NS) {
+			c->stats.stalls++;
+			rcmetrics_add(m_stalls, 1);
+		}
+		c->stale0[c->curtx] = c->bh;
+		c->stale1[c->curtx] = 0;
+	}
+	c->stats.presents++;
+	rcmetrics_add(m_presents, 1);
+	SDL_UnlockMutex(c->mutex);
+
+	present(c);
+}
+
+/*
+ * openwindow - Create a context's window, renderer and texture
+ */
+static void openwindow(struct rcgl_ctx *c)
+{
+	int rval = 1;
+	struct CARGS *a = &c->cargs;
+	SDL_DisplayMode mode;
+	int ntx;
+
+	if (nopen == MAXCTX) {
+		fprintf(stderr, "RCGL: Too many windows\n");
+		rval = -4;
+		goto failwind;
+	}
+	c->wind = SDL_CreateWindow(a->title,
 	           SDL_WINDOWPOS_UNDEFINED,
 	           SDL_WINDOWPOS_UNDEFINED,
-	           cargs.ww,
-	           cargs.wh,
-	           ((cargs.wflags&RCGL_RESIZE)?SDL_WINDOW_RESIZABLE:0)
-	           | ((cargs.wflags&RCGL_FULLSCREEN)?SDL_WINDOW_FULLSCREEN:0)
-	           | ((cargs.wflags&RCGL_MAXIMIZED)?SDL_WINDOW_MAXIMIZED:0)
-	           | ((cargs.wflags&RCGL_FULLSCREEN_NATIVE)?SDL_WINDOW_FULLSCREEN_DESKTOP:0)
+	           a->ww,
+	           a->wh,
+	           ((a->wflags&RCGL_RESIZE)?SDL_WINDOW_RESIZABLE:0)
+	           | ((a->wflags&RCGL_FULLSCREEN)?SDL_WINDOW_FULLSCREEN:0)
+	           | ((a->wflags&RCGL_MAXIMIZED)?SDL_WINDOW_MAXIMIZED:0)
+	           | ((a->wflags&RCGL_FULLSCREEN_NATIVE)?SDL_WINDOW_FULLSCREEN_DESKTOP:0)
+	           | ((a->wflags&RCGL_HIDDEN)?SDL_WINDOW_HIDDEN:0)
 	           | SDL_WINDOW_ALLOW_HIGHDPI);
-	if (wind == NULL) {
+	if (c->wind == NULL) {
 		fprintf(stderr, "RCGL: Failed to create Window: %s\n",
 		        SDL_GetError());
 		rval = -4;
 		goto failwind;
 	}
 	
-	rend = SDL_CreateRenderer(wind, -1, 0);
-	if (rend == NULL) {
+	c->rend = SDL_CreateRenderer(c->wind, -1,
+	           (a->wflags&RCGL_VSYNC)?SDL_RENDERER_PRESENTVSYNC:0);
+	if (c->rend == NULL) {
 		fprintf(stderr, "RCGL: Failed to create Renderer: %s\n",
 		        SDL_GetError());
 		rval = -4;
 		goto failrend;
 	}
-	SDL_RenderSetLogicalSize(rend, cargs.w, cargs.h);
-	SDL_RenderSetIntegerScale(rend, cargs.wflags & RCGL_INTSCALE);
+	SDL_RenderSetLogicalSize(c->rend, a->w, a->h);
+	// Start from the display's nominal rate until presents refine it
+	c->period = 1000000000ull / 60;
+	if (SDL_GetWindowDisplayMode(c->wind, &mode) == 0 && mode.refresh_rate > 0)
+		c->period = 1000000000ull / mode.refresh_rate;
+	SDL_RenderSetIntegerScale(c->rend, a->wflags & RCGL_INTSCALE);
 	
-	tx = SDL_CreateTexture(rend,
-	                       SDL_PIXELFORMAT_ARGB8888,
-	                       SDL_TEXTUREACCESS_STREAMING,
-	                       cargs.w,
-	                       cargs.h);
-	if (tx == NULL) {
-		fprintf(stderr, "RCGL: Failed to create Texture: %s\n",
-		        SDL_GetError());
-		rval = -4;
-		goto failtx;
+	for (ntx = 0; ntx < NTEX; ntx++) {
+		c->tx[ntx] = SDL_CreateTexture(c->rend,
+		                       SDL_PIXELFORMAT_ARGB8888,
+		                       SDL_TEXTUREACCESS_STREAMING,
+		                       a->w,
+		                       a->h);
+		if (c->tx[ntx] == NULL) {
+			fprintf(stderr, "RCGL: Failed to create Texture: %s\n",
+			        SDL_GetError());
+			rval = -4;
+			goto failtx;
+		}
+		c->stale0[ntx] = 0;
+		c->stale1[ntx] = a->h;
 	}
-
+	c->curtx = 0;
 	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, 0);
-	SDL_SetRenderDrawColor(rend, 0, 0, 0, 0);
-	SDL_RenderClear(rend);
+	SDL_SetRenderDrawColor(c->rend, 0, 0, 0, 0);
+	SDL_RenderClear(c->rend);
 	SDL_GL_SetSwapInterval(1);
-
 	// Clear initial window
-	SDL_SetRenderDrawColor(rend, 0, 0, 0, 255);
-	SDL_RenderClear(rend);
-	SDL_RenderPresent(rend);              // Do update
+	SDL_SetRenderDrawColor(c->rend, 0, 0, 0, 255);
+	SDL_RenderClear(c->rend);
+	SDL_RenderPresent(c->rend);              // Do update
+	SDL_AtomicSet(&c->status, 1);
+	ctxs[nopen++] = c;
+	goto done;
+
+failtx:
+	while (ntx-- > 0)
+		SDL_DestroyTexture(c->tx[ntx]);
+	SDL_DestroyRenderer(c->rend);
+failrend:
+	SDL_DestroyWindow(c->wind);
+failwind:
+done:
+	// Signal to the creating thread how it went
+	SDL_LockMutex(c->mutex);
+	c->initstatus = rval;
+	SDL_CondBroadcast(c->initcond);
+	SDL_UnlockMutex(c->mutex);
+}
+
+/*
+ * closewindow - Destroy a context's window
+ */
+static void closewindow(struct rcgl_ctx *c)
+{
+	for (int i = 0; i < nopen; i++) {
+		if (ctxs[i] == c) {
+			ctxs[i] = ctxs[--nopen];
+			break;
+		}
+	}
+	SDL_AtomicSet(&c->status, 0);
+	for (int i = 0; i < NTEX; i++)
+		SDL_DestroyTexture(c->tx[i]);
+	SDL_DestroyRenderer(c->rend);
+	SDL_DestroyWindow(c->wind);
+
+	SDL_LockMutex(c->mutex);
+	c->initstatus = 0;
+	SDL_CondBroadcast(c->initcond);
+	SDL_UnlockMutex(c->mutex);
+}
+
+/*
+ * Background and screen update handler, shared by all contexts
+ *
+ * NOTE: This is the only thread allowed to call WaitEvent/PollEvent/PumpEvents
+ * Though to do so we need to move the SDL init code here :/
+ */
+static int videothread(void *data)
+{
+	SDL_Event event;
+	struct rcgl_ctx *c;
+	int running;
 
-	SDL_AtomicSet(&status, 1);
+	(void)data;
 
+	/* Video initialization */
+	if (SDL_Init(SDL_INIT_VIDEO) < 0) {
+		fprintf(stderr, "RCGL: Failed to initialize SDL: %s\n",
+		        SDL_GetError());
+		threadstatus = -4;
+		SDL_SemPost(ready);
+		return threadstatus;
+	}
 	// Signal to parent thread that initialization has been successful
-	SDL_LockMutex(mutex);
-	initstatus = 1;
-	SDL_CondBroadcast(initcond);
-	SDL_UnlockMutex(mutex);
+	threadstatus = 1;
+	SDL_SemPost(ready);
+
 
-	
-	
 	running = 1;
 	while (running) {
 		if (SDL_WaitEvent(&event)) {
 			// Handle events
 			do {
 				if (event.type == EVENT_REDRAW) {
-					dstatus = 1;
-					if (0 == SDL_LockTexture(tx, NULL, &rbuf, &pitch)) 
-						blit(buf, (uint32_t *)rbuf);	  // Palettize and copy to texture
-					else // Otherwise Failed to open texture, couldn't render.
-						dstatus = 0;
-						
-					SDL_UnlockTexture(tx);
-					SDL_SetRenderDrawColor(rend, 0, 0, 0, 0);
-					SDL_RenderClear(rend);
-					SDL_RenderCopy(rend, tx, NULL, NULL); // Render texture to entire window
-					SDL_RenderPresent(rend);              // Do update
-
-					// Let update method return now that we're done
-					SDL_LockMutex(mutex);
-					SDL_CondBroadcast(waitdrawcond);
-					drawstatus = dstatus;
-					SDL_UnlockMutex(mutex);
+					redraw(event.user.data1);
+				}
+				else if (event.type == EVENT_OPEN) {
+					openwindow(event.user.data1);
+				}
+				else if (event.type == EVENT_CLOSE) {
+					closewindow(event.user.data1);
 				}
 				else if (event.type == EVENT_TERM) {
-					SDL_AtomicSet(&status, 0);
 					running = 0;
 				}
 				else switch (event.type) {
 				case SDL_QUIT:
-					SDL_AtomicSet(&status, 0);
-					running = 0;
+					// Every window has been closed
+					for (int i = 0; i < nopen; i++)
+						SDL_AtomicSet(&ctxs[i]->status, 0);
 					break;
 				case SDL_WINDOWEVENT:
-					// Assume something happened to the window, so just redraw
-					SDL_SetRenderDrawColor(rend, 0, 0, 0, 0);
-					SDL_RenderClear(rend);
-					SDL_RenderCopy(rend, tx, NULL, NULL); // Render texture to entire window
-					SDL_RenderPresent(rend);              // Do update
+					if ((c = winctx(event.window.windowID)) == NULL)
+						break;
+					if (event.window.event == SDL_WINDOWEVENT_CLOSE)
+						SDL_AtomicSet(&c->status, 0);
+					else // Assume something happened, so just redraw
+						present(c);
+					break;
+				case SDL_KEYDOWN:
+				case SDL_KEYUP:
+				case SDL_MOUSEMOTION:
+				case SDL_MOUSEBUTTONDOWN:
+				case SDL_MOUSEBUTTONUP:
+				case SDL_MOUSEWHEEL:
+					input(&event);
 					break;
-				
 				}
 			} while (SDL_PollEvent(&event));
 		}
 	}
 	
-failalloc:
-	SDL_DestroyTexture(tx);
-failtx:
-	SDL_DestroyRenderer(rend);
-failrend:
-	SDL_DestroyWindow(wind);
-failwind:
 	SDL_Quit();
-
-	// Signal to parent thread that we failed
-	if (rval < 0) {
-		SDL_LockMutex(mutex);
-		initstatus = rval;
-		SDL_CondBroadcast(initcond);
-		SDL_UnlockMutex(mutex);
-	}
-	
-	return rval;
+	return 0;
 }
-
-
-/* Palettes */
-
-const uint32_t RCGL_PALETTE_VGA[256] = {
-0x00000000, 0x000000aa, 0x0000aa00, 0x0000aaaa, 0x00aa0000, 0x00aa00aa, 
-0x00aa5500, 0x00aaaaaa, 0x00555555, 0x005555ff, 0x0055ff55, 0x0055ffff, 
-0x00ff5555, 0x00ff55ff, 0x00ffff55, 0x00ffffff, 0x00000000, 0x00141414, 
-0x00202020, 0x002c2c2c, 0x00383838, 0x00454545, 0x00515151, 0x00616161, 
-0x00717171, 0x00828282, 0x00929292, 0x00a2a2a2, 0x00b6b6b6, 0x00cbcbcb, 
-0x00e3e3e3, 0x00ffffff, 0x000000ff, 0x004100ff, 0x007d00ff, 0x00be00ff, 
-0x00ff00ff, 0x00ff00be, 0x00ff007d, 0x00ff0041, 0x00ff0000, 0x00ff4100, 
-0x00ff7d00, 0x00ffbe00, 0x00ffff00, 0x00beff00, 0x007dff00, 0x0041ff00, 
-0x0000ff00, 0x0000ff41, 0x0000ff7d, 0x0000ffbe, 0x0000ffff, 0x0000beff, 
-0x00007dff, 0x000041ff, 0x007d7dff, 0x009e7dff, 0x00be7dff, 0x00df7dff, 
-0x00ff7dff, 0x00ff7ddf, 0x00ff7dbe, 0x00ff7d9e, 0x00ff7d7d, 0x00ff9e7d, 
-0x00ffbe7d, 0x00ffdf7d, 0x00ffff7d, 0x00dfff7d, 0x00beff7d, 0x009eff7d, 
-0x007dff7d, 0x007dff9e, 0x007dffbe, 0x007dffdf, 0x007dffff, 0x007ddfff, 
-0x007dbeff, 0x007d9eff, 0x00b6b6ff, 0x00c7b6ff, 0x00dbb6ff, 0x00ebb6ff, 
-0x00ffb6ff, 0x00ffb6eb, 0x00ffb6db, 0x00ffb6c7, 0x00ffb6b6, 0x00ffc7b6, 
-0x00ffdbb6, 0x00ffebb6, 0x00ffffb6, 0x00ebffb6, 0x00dbffb6, 0x00c7ffb6, 
-0x00b6ffb6, 0x00b6ffc7, 0x00b6ffdb, 0x00b6ffeb, 0x00b6ffff, 0x00b6ebff, 
-0x00b6dbff, 0x00b6c7ff, 0x00000071, 0x001c0071, 0x00380071, 0x00550071, 
-0x00710071, 0x00710055, 0x00710038, 0x0071001c, 0x00710000, 0x00711c00, 
-0x00713800, 0x00715500, 0x00717100, 0x00557100, 0x00387100, 0x001c7100, 
-0x00007100, 0x0000711c, 0x00007138, 0x00007155, 0x00007171, 0x00005571, 
-0x00003871, 0x00001c71, 0x00383871, 0x00453871, 0x00553871, 0x00613871, 
-0x00713871, 0x00713861, 0x00713855, 0x00713845, 0x00713838, 0x00714538, 
-0x00715538, 0x00716138, 0x00717138, 0x00617138, 0x00557138, 0x00457138, 
-0x00387138, 0x00387145, 0x00387155, 0x00387161, 0x00387171, 0x00386171, 
-0x00385571, 0x00384571, 0x00515171, 0x00595171, 0x00615171, 0x00695171, 
-0x00715171, 0x00715169, 0x00715161, 0x00715159, 0x00715151, 0x00715951, 
-0x00716151, 0x00716951, 0x00717151, 0x00697151, 0x00617151, 0x00597151, 
-0x00517151, 0x00517159, 0x00517161, 0x00517169, 0x00517171, 0x00516971, 
-0x00516171, 0x00515971, 0x00000041, 0x00100041, 0x00200041, 0x00300041, 
-0x00410041, 0x00410030, 0x00410020, 0x00410010, 0x00410000, 0x00411000, 
-0x00412000, 0x00413000, 0x00414100, 0x00304100, 0x00204100, 0x00104100, 
-0x00004100, 0x00004110, 0x00004120, 0x00004130, 0x00004141, 0x00003041, 
-0x00002041, 0x00001041, 0x00202041, 0x00282041, 0x00302041, 0x00382041, 
-0x00412041, 0x00412038, 0x00412030, 0x00412028, 0x00412020, 0x00412820, 
-0x00413020, 0x00413820, 0x00414120, 0x00384120, 0x00304120, 0x00284120, 
-0x00204120, 0x00204128, 0x00204130, 0x00204138, 0x00204141, 0x00203841, 
-0x00203041, 0x00202841, 0x002c2c41, 0x00302c41, 0x00342c41, 0x003c2c41, 
-0x00412c41, 0x00412c3c, 0x00412c34, 0x00412c30, 0x00412c2c, 0x0041302c, 
-0x0041342c, 0x00413c2c, 0x0041412c, 0x003c412c, 0x0034412c, 0x0030412c, 
-0x002c412c, 0x002c4130, 0x002c4134, 0x002c413c, 0x002c4141, 0x002c3c41, 
-0x002c3441, 0x002c3041, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 
-0x00000000, 0x00000000, 0x00000000, 0x00000000 };
-
-const uint32_t RCGL_PALETTE_GREY[256] = {
-0x00000000, 0x00010101, 0x00020202, 0x00030303, 0x00040404, 0x00050505, 
-0x00060606, 0x00070707, 0x00080808, 0x00090909, 0x000a0a0a, 0x000b0b0b, 
-0x000c0c0c, 0x000d0d0d, 0x000e0e0e, 0x000f0f0f, 0x00101010, 0x00111111, 
-0x00121212, 0x00131313, 0x00141414, 0x00151515, 0x00161616, 0x00171717, 
-0x00181818, 0x00191919, 0x001a1a1a, 0x001b1b1b, 0x001c1c1c, 0x001d1d1d, 
-0x001e1e1e, 0x001f1f1f, 0x00202020, 0x00212121, 0x00222222, 0x00232323, 
-0x00242424, 0x00252525, 0x00262626, 0x00272727, 0x00282828, 0x00292929, 
-0x002a2a2a, 0x002b2b2b, 0x002c2c2c, 0x002d2d2d, 0x002e2e2e, 0x002f2f2f, 
-0x00303030, 0x00313131, 0x00323232, 0x00333333, 0x00343434, 0x00353535, 
-0x00363636, 0x00373737, 0x00383838, 0x00393939, 0x003a3a3a, 0x003b3b3b, 
-0x003c3c3c, 0x003d3d3d, 0x003e3e3e, 0x003f3f3f, 0x00404040, 0x00414141, 
-0x00424242, 0x00434343, 0x00444444, 0x00454545, 0x00464646, 0x00474747, 
-0x00484848, 0x00494949, 0x004a4a4a, 0x004b4b4b, 0x004c4c4c, 0x004d4d4d, 
-0x004e4e4e, 0x004f4f4f, 0x00505050, 0x00515151, 0x00525252, 0x00535353, 
-0x00545454, 0x00555555, 0x00565656, 0x00575757, 0x00585858, 0x00595959, 
-0x005a5a5a, 0x005b5b5b, 0x005c5c5c, 0x005d5d5d, 0x005e5e5e, 0x005f5f5f, 
-0x00606060, 0x00616161, 0x00626262, 0x00636363, 0x00646464, 0x00656565, 
-0x00666666, 0x00676767, 0x00686868, 0x00696969, 0x006a6a6a, 0x006b6b6b, 
-0x006c6c6c, 0x006d6d6d, 0x006e6e6e, 0x006f6f6f, 0x00707070, 0x00717171, 
-0x00727272, 0x00737373, 0x00747474, 0x00757575, 0x00767676, 0x00777777, 
-0x00787878, 0x00797979, 0x007a7a7a, 0x007b7b7b, 0x007c7c7c, 0x007d7d7d, 
-0x007e7e7e, 0x007f7f7f, 0x00808080, 0x00818181, 0x00828282, 0x00838383, 
-0x00848484, 0x00858585, 0x00868686, 0x00878787, 0x00888888, 0x00898989, 
-0x008a8a8a, 0x008b8b8b, 0x008c8c8c, 0x008d8d8d, 0x008e8e8e, 0x008f8f8f, 
-0x00909090, 0x00919191, 0x00929292, 0x00939393, 0x00949494, 0x00959595, 
-0x00969696, 0x00979797, 0x00989898, 0x00999999, 0x009a9a9a, 0x009b9b9b, 
-0x009c9c9c, 0x009d9d9d, 0x009e9e9e, 0x009f9f9f, 0x00a0a0a0, 0x00a1a1a1, 
-0x00a2a2a2, 0x00a3a3a3, 0x00a4a4a4, 0x00a5a5a5, 0x00a6a6a6, 0x00a7a7a7, 
-0x00a8a8a8, 0x00a9a9a9, 0x00aaaaaa, 0x00ababab, 0x00acacac, 0x00adadad, 
-0x00aeaeae, 0x00afafaf, 0x00b0b0b0, 0x00b1b1b1, 0x00b2b2b2, 0x00b3b3b3, 
-0x00b4b4b4, 0x00b5b5b5, 0x00b6b6b6, 0x00b7b7b7, 0x00b8b8b8, 0x00b9b9b9, 
-0x00bababa, 0x00bbbbbb, 0x00bcbcbc, 0x00bdbdbd, 0x00bebebe, 0x00bfbfbf, 
-0x00c0c0c0, 0x00c1c1c1, 0x00c2c2c2, 0x00c3c3c3, 0x00c4c4c4, 0x00c5c5c5, 
-0x00c6c6c6, 0x00c7c7c7, 0x00c8c8c8, 0x00c9c9c9, 0x00cacaca, 0x00cbcbcb, 
-0x00cccccc, 0x00cdcdcd, 0x00cecece, 0x00cfcfcf, 0x00d0d0d0, 0x00d1d1d1, 
-0x00d2d2d2, 0x00d3d3d3, 0x00d4d4d4, 0x00d5d5d5, 0x00d6d6d6, 0x00d7d7d7, 
-0x00d8d8d8, 0x00d9d9d9, 0x00dadada, 0x00dbdbdb, 0x00dcdcdc, 0x00dddddd, 
-0x00dedede, 0x00dfdfdf, 0x00e0e0e0, 0x00e1e1e1, 0x00e2e2e2, 0x00e3e3e3, 
-0x00e4e4e4, 0x00e5e5e5, 0x00e6e6e6, 0x00e7e7e7, 0x00e8e8e8, 0x00e9e9e9, 
-0x00eaeaea, 0x00ebebeb, 0x00ececec, 0x00ededed, 0x00eeeeee, 0x00efefef, 
-0x00f0f0f0, 0x00f1f1f1, 0x00f2f2f2, 0x00f3f3f3, 0x00f4f4f4, 0x00f5f5f5, 
-0x00f6f6f6, 0x00f7f7f7, 0x00f8f8f8, 0x00f9f9f9, 0x00fafafa, 0x00fbfbfb, 
-0x00fcfcfc, 0x00fdfdfd, 0x00fefefe, 0x00ffffff };
-
-
@@ -6,7 +6,8 @@
  * VGA days.
  *
  * To link with your program (with gcc), include rcgl.h and compile
- *   gcc -o <prog> <source files> rcgl.c -lSDL2
+ *   gcc -o <prog> <source files> rcgl.c rcglpal.c rcglrec.c rcglshm.c \
+ *       rcmetrics.c -lSDL2
  *
  * Why a wrapper on top of SDL2? Why not just use it directly?
  *
@@ -58,6 +59,67 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define RCGL_MAXIMIZED  4
 #define RCGL_FULLSCREEN_NATIVE 8
 #define RCGL_INTSCALE	16
+#define RCGL_VSYNC      32
+#define RCGL_HIDDEN     64
+
+#define RCGL_MAXLAYERS  4
+#define RCGL_DENSE      0
+#define RCGL_SPARSE     1
+
+#define RCGL_REC_GIF    1
+#define RCGL_REC_Y4M    2
+
+/* rcgl_shm_read results */
+#define RCGL_SHM_FRAME   1
+#define RCGL_SHM_PALETTE 2
+
+/* Input event types */
+#define RCGL_KEYDOWN    1
+#define RCGL_KEYUP      2
+#define RCGL_MOUSEMOVE  3
+#define RCGL_MOUSEDOWN  4
+#define RCGL_MOUSEUP    5
+#define RCGL_MOUSEWHEEL 6
+
+/* Keys are SDL scancodes, a few common ones for programs without SDL.h */
+#define RCGL_NKEYS      512
+#define RCGL_KEY_A      4       // Through RCGL_KEY_A+25 for Z
+#define RCGL_KEY_1      30      // Through RCGL_KEY_1+8 for 9, then 0
+#define RCGL_KEY_RETURN 40
+#define RCGL_KEY_ESCAPE 41
+#define RCGL_KEY_SPACE  44
+#define RCGL_KEY_RIGHT  79
+#define RCGL_KEY_LEFT   80
+#define RCGL_KEY_DOWN   81
+#define RCGL_KEY_UP     82
+
+struct rcgl_event {
+	uint8_t type;
+	uint8_t button;         // Mouse button, 1 left, 2 middle, 3 right
+	uint16_t key;           // Scancode for key events
+	int16_t x, y;           // Mouse position in buffer pixels, or wheel motion
+};
+
+/* Per context. The same counts, summed over every context, and time spent
+ * compositing, uploading and presenting go to rcmetrics as well. */
+struct rcgl_stats {
+	uint32_t updates;           // rcgl_update calls
+	uint32_t presents;          // Frames put on screen
+	uint32_t coalesced;         // Updates merged into a later present
+	uint32_t stalls;            // Texture uploads that took over 1 ms
+	uint32_t events_dropped;    // Input events lost to a full queue
+};
+
+struct rcgl_point {
+	uint16_t x, y;
+	uint8_t c;
+};
+
+/* Each window is a context. The calls without a context argument act on the
+ * default one opened by rcgl_init, whose palette is rcgl_palette. Further
+ * windows come from rcgl_create and are driven with the rcgl_ctx_* calls,
+ * each from whichever thread the program likes. */
+struct rcgl_ctx;
 
 extern uint32_t rcgl_palette[256];
 
@@ -72,9 +134,63 @@ uint8_t *rcgl_getbuf(void);
 int rcgl_hasquit(void);
 void rcgl_delay(uint32_t ms);
 uint32_t rcgl_ticks(void);
+uint64_t rcgl_now_ns(void);
+void rcgl_wait_until(uint64_t ns);
+uint64_t rcgl_next_vsync(uint64_t *period);
+void rcgl_stats(struct rcgl_stats *st);
 void rcgl_plot(int x, int y, uint8_t c);
 void rcgl_setpalette(const uint32_t palette[256]);
 void rcgl_line(int x1, int y1, int x2, int y2, uint8_t c);
 void rcgl_blit(uint8_t *b, int x, int y, int w, int h, int trans, uint8_t *plt);
+int rcgl_newlayer(int type);
+uint8_t *rcgl_getlayer(int l);
+void rcgl_showlayer(int l, int visible);
+void rcgl_setautodirty(int l, int on);
+void rcgl_dirty(int l, int y, int h);
+void rcgl_setpoints(int l, const struct rcgl_point *pts, int n);
+int rcgl_poll_event(struct rcgl_event *ev);
+int rcgl_key_down(int key);
+int rcgl_record_start(const char *path, int format, int fps);
+int rcgl_record_stop(void);
+int rcgl_publish(const char *name);
+void rcgl_unpublish(void);
+
+struct rcgl_ctx *rcgl_create(int w, int h, int ww, int wh, const char *title,
+                             int wflags);
+void rcgl_destroy(struct rcgl_ctx *c);
+int rcgl_ctx_update(struct rcgl_ctx *c);
+void rcgl_ctx_setbuf(struct rcgl_ctx *c, uint8_t *b);
+uint8_t *rcgl_ctx_getbuf(struct rcgl_ctx *c);
+int rcgl_ctx_hasquit(struct rcgl_ctx *c);
+uint64_t rcgl_ctx_next_vsync(struct rcgl_ctx *c, uint64_t *period);
+void rcgl_ctx_stats(struct rcgl_ctx *c, struct rcgl_stats *st);
+void rcgl_ctx_plot(struct rcgl_ctx *ctx, int x, int y, uint8_t c);
+void rcgl_ctx_setpalette(struct rcgl_ctx *c, const uint32_t palette[256]);
+void rcgl_ctx_line(struct rcgl_ctx *ctx, int x1, int y1, int x2, int y2,
+                   uint8_t c);
+void rcgl_ctx_blit(struct rcgl_ctx *ctx, uint8_t *b, int x, int y, int w, int h,
+                   int trans, uint8_t *plt);
+int rcgl_ctx_newlayer(struct rcgl_ctx *c, int type);
+uint8_t *rcgl_ctx_getlayer(struct rcgl_ctx *c, int l);
+void rcgl_ctx_showlayer(struct rcgl_ctx *c, int l, int visible);
+void rcgl_ctx_setautodirty(struct rcgl_ctx *c, int l, int on);
+void rcgl_ctx_dirty(struct rcgl_ctx *c, int l, int y, int h);
+void rcgl_ctx_setpoints(struct rcgl_ctx *c, int l, const struct rcgl_point *pts,
+                        int n);
+int rcgl_ctx_poll_event(struct rcgl_ctx *c, struct rcgl_event *ev);
+int rcgl_ctx_key_down(struct rcgl_ctx *c, int key);
+int rcgl_ctx_record_start(struct rcgl_ctx *c, const char *path, int format,
+                          int fps);
+int rcgl_ctx_record_stop(struct rcgl_ctx *c);
+int rcgl_ctx_publish(struct rcgl_ctx *c, const char *name);
+void rcgl_ctx_unpublish(struct rcgl_ctx *c);
+
+/* Viewing frames published by another process */
+struct rcgl_shm;
+
+struct rcgl_shm *rcgl_shm_open(const char *name, int *w, int *h);
+int rcgl_shm_read(struct rcgl_shm *s, uint8_t *buf, uint32_t pal[256],
+                  int *y0, int *y1);
+void rcgl_shm_close(struct rcgl_shm *s);
 
 #endif
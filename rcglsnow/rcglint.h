@@ -0,0 +1,110 @@
+/* RCGL C Graphics Library - Internal interfaces
+ *
+ * Shared between the library's source files, not for use by programs.
+ *
+ * See rcgl.h for license (BSD 3-Clause).
+ */
+#ifndef RCGLINT_H
+#define RCGLINT_H
+
+#include "rcgl.h"
+#include <SDL2/SDL.h>
+#include <stdint.h>
+
+/* Video capture, rcglrec.c */
+struct rec;
+
+struct rec *rec_start(const char *path, int format, int w, int h, int fps);
+void rec_frame(struct rec *rec, const uint8_t *frame, const uint32_t *pal,
+               uint32_t ticks);
+int rec_stop(struct rec *rec);
+
+/* Shared-memory publishing, rcglshm.c */
+struct shm;
+
+struct shm *shm_create(const char *name, int w, int h, uint8_t **pixels);
+void shm_begin(struct shm *s);
+void shm_end(struct shm *s, int y0, int y1, const uint32_t *pal, int palchanged);
+void shm_destroy(struct shm *s);
+
+/* Display contexts, rcgl.c */
+void rcgl_blitrow(const uint32_t *pal, const uint8_t *src, uint32_t *dst,
+                  int w);
+
+#define NEVENTS 256             // Input event ring size, a power of two
+#define NTEX    3               // Streaming textures uploads rotate through
+#define STALL_NS 1000000        // Uploads slower than this count as stalls
+
+struct LAYER {
+	uint8_t *buf;                   // Pixels, NULL for sparse layers
+	const struct rcgl_point *pts;   // Points for sparse layers
+	int npts;
+	int type;
+	int visible;
+	int autodirty;                  // Treat every row as dirty each update
+	int dirty0, dirty1;             // Dirty rows [dirty0, dirty1)
+};
+
+struct CARGS {
+	int w, h, ww, wh;
+	const char *title;
+	int wflags;
+};
+
+/*
+ * Everything belonging to one window. Fields under "event thread" are only
+ * touched from there once the context is open, the rest belong to the
+ * program's thread, with the mutex and conditions handing frames between.
+ */
+struct rcgl_ctx {
+	/* Event thread */
+	SDL_Window *wind;
+	SDL_Renderer *rend;
+	SDL_Texture *tx[NTEX];
+	int curtx;                      // Texture last uploaded and shown
+	int stale0[NTEX], stale1[NTEX]; // Rows each texture is behind on
+
+	SDL_cond *initcond;             // Signalled when opened or closed
+	SDL_mutex *mutex;
+	int initstatus;                 // 1 open, 0 closed, <0 failed to open
+
+	/* Guarded by mutex, handing frames to the event thread */
+	int pending;                    // A redraw is queued
+	int up0, up1;                   // Rows of obuf changed since it ran
+	int drawstatus;                 // Last upload worked
+	struct rcgl_stats stats;
+	uint64_t vsync;                 // Last present, rcgl_now_ns, guarded
+	uint64_t period;                // Estimated refresh period, guarded
+
+	SDL_atomic_t status;            // 0 once the window has been closed
+
+	uint32_t *pal;                  // rcgl_palette for the default context
+	uint32_t palette[256];
+	int bw;                         // Buffer width
+	int bh;                         // Buffer height
+	uint8_t *buf;                   // Pointer to user buffer
+	uint8_t *ibuf;                  // Internal/Default user buffer
+
+	uint8_t *cbuf;                  // Composite of all layers, in shm if set
+	uint32_t *obuf;                 // Palettized composite, uploaded to tx
+	uint8_t *rowdirty;              // Rows to recomposite this frame
+	uint8_t *ptrows;                // Rows holding points last frame
+	int paldirty;                   // Palette changed, redo everything
+
+	struct LAYER layers[RCGL_MAXLAYERS];
+	int nlayers;
+
+	struct rec *rec;                // Active recording, if any
+	struct shm *shm;                // Segment frames are published to
+
+	/* Input events, a single-producer (event thread) single-consumer ring */
+	struct rcgl_event events[NEVENTS];
+	SDL_atomic_t evhead;            // Next event to write
+	SDL_atomic_t evtail;            // Next event to read
+	SDL_atomic_t evdropped;
+	SDL_atomic_t keys[RCGL_NKEYS/32];   // Keys held, written by event thread
+
+	struct CARGS cargs;
+};
+
+#endif
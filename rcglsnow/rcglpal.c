@@ -0,0 +1,105 @@
+/* RCGL C Graphics Library - Built-in palettes
+ *
+ * Kept apart from rcgl.c so tools that only need the colour tables (mkpak)
+ * can link them without pulling in SDL.
+ *
+ * See rcgl.h for license (BSD 3-Clause).
+ */
+
+#include "rcgl.h"
+#include <stdint.h>
+
+
+/* Palettes */
+
+const uint32_t RCGL_PALETTE_VGA[256] = {
+0x00000000, 0x000000aa, 0x0000aa00, 0x0000aaaa, 0x00aa0000, 0x00aa00aa, 
+0x00aa5500, 0x00aaaaaa, 0x00555555, 0x005555ff, 0x0055ff55, 0x0055ffff, 
+0x00ff5555, 0x00ff55ff, 0x00ffff55, 0x00ffffff, 0x00000000, 0x00141414, 
+0x00202020, 0x002c2c2c, 0x00383838, 0x00454545, 0x00515151, 0x00616161, 
+0x00717171, 0x00828282, 0x00929292, 0x00a2a2a2, 0x00b6b6b6, 0x00cbcbcb, 
+0x00e3e3e3, 0x00ffffff, 0x000000ff, 0x004100ff, 0x007d00ff, 0x00be00ff, 
+0x00ff00ff, 0x00ff00be, 0x00ff007d, 0x00ff0041, 0x00ff0000, 0x00ff4100, 
+0x00ff7d00, 0x00ffbe00, 0x00ffff00, 0x00beff00, 0x007dff00, 0x0041ff00, 
+0x0000ff00, 0x0000ff41, 0x0000ff7d, 0x0000ffbe, 0x0000ffff, 0x0000beff, 
+0x00007dff, 0x000041ff, 0x007d7dff, 0x009e7dff, 0x00be7dff, 0x00df7dff, 
+0x00ff7dff, 0x00ff7ddf, 0x00ff7dbe, 0x00ff7d9e, 0x00ff7d7d, 0x00ff9e7d, 
+0x00ffbe7d, 0x00ffdf7d, 0x00ffff7d, 0x00dfff7d, 0x00beff7d, 0x009eff7d, 
+0x007dff7d, 0x007dff9e, 0x007dffbe, 0x007dffdf, 0x007dffff, 0x007ddfff, 
+0x007dbeff, 0x007d9eff, 0x00b6b6ff, 0x00c7b6ff, 0x00dbb6ff, 0x00ebb6ff, 
+0x00ffb6ff, 0x00ffb6eb, 0x00ffb6db, 0x00ffb6c7, 0x00ffb6b6, 0x00ffc7b6, 
+0x00ffdbb6, 0x00ffebb6, 0x00ffffb6, 0x00ebffb6, 0x00dbffb6, 0x00c7ffb6, 
+0x00b6ffb6, 0x00b6ffc7, 0x00b6ffdb, 0x00b6ffeb, 0x00b6ffff, 0x00b6ebff, 
+0x00b6dbff, 0x00b6c7ff, 0x00000071, 0x001c0071, 0x00380071, 0x00550071, 
+0x00710071, 0x00710055, 0x00710038, 0x0071001c, 0x00710000, 0x00711c00, 
+0x00713800, 0x00715500, 0x00717100, 0x00557100, 0x00387100, 0x001c7100, 
+0x00007100, 0x0000711c, 0x00007138, 0x00007155, 0x00007171, 0x00005571, 
+0x00003871, 0x00001c71, 0x00383871, 0x00453871, 0x00553871, 0x00613871, 
+0x00713871, 0x00713861, 0x00713855, 0x00713845, 0x00713838, 0x00714538, 
+0x00715538, 0x00716138, 0x00717138, 0x00617138, 0x00557138, 0x00457138, 
+0x00387138, 0x00387145, 0x00387155, 0x00387161, 0x00387171, 0x00386171, 
+0x00385571, 0x00384571, 0x00515171, 0x00595171, 0x00615171, 0x00695171, 
+0x00715171, 0x00715169, 0x00715161, 0x00715159, 0x00715151, 0x00715951, 
+0x00716151, 0x00716951, 0x00717151, 0x00697151, 0x00617151, 0x00597151, 
+0x00517151, 0x00517159, 0x00517161, 0x00517169, 0x00517171, 0x00516971, 
+0x00516171, 0x00515971, 0x00000041, 0x00100041, 0x00200041, 0x00300041, 
+0x00410041, 0x00410030, 0x00410020, 0x00410010, 0x00410000, 0x00411000, 
+0x00412000, 0x00413000, 0x00414100, 0x00304100, 0x00204100, 0x00104100, 
+0x00004100, 0x00004110, 0x00004120, 0x00004130, 0x00004141, 0x00003041, 
+0x00002041, 0x00001041, 0x00202041, 0x00282041, 0x00302041, 0x00382041, 
+0x00412041, 0x00412038, 0x00412030, 0x00412028, 0x00412020, 0x00412820, 
+0x00413020, 0x00413820, 0x00414120, 0x00384120, 0x00304120, 0x00284120, 
+0x00204120, 0x00204128, 0x00204130, 0x00204138, 0x00204141, 0x00203841, 
+0x00203041, 0x00202841, 0x002c2c41, 0x00302c41, 0x00342c41, 0x003c2c41, 
+0x00412c41, 0x00412c3c, 0x00412c34, 0x00412c30, 0x00412c2c, 0x0041302c, 
+0x0041342c, 0x00413c2c, 0x0041412c, 0x003c412c, 0x0034412c, 0x0030412c, 
+0x002c412c, 0x002c4130, 0x002c4134, 0x002c413c, 0x002c4141, 0x002c3c41, 
+0x002c3441, 0x002c3041, 0x00000000, 0x00000000, 0x00000000, 0x00000000, 
+0x00000000, 0x00000000, 0x00000000, 0x00000000 };
+
+const uint32_t RCGL_PALETTE_GREY[256] = {
+0x00000000, 0x00010101, 0x00020202, 0x00030303, 0x00040404, 0x00050505, 
+0x00060606, 0x00070707, 0x00080808, 0x00090909, 0x000a0a0a, 0x000b0b0b, 
+0x000c0c0c, 0x000d0d0d, 0x000e0e0e, 0x000f0f0f, 0x00101010, 0x00111111, 
+0x00121212, 0x00131313, 0x00141414, 0x00151515, 0x00161616, 0x00171717, 
+0x00181818, 0x00191919, 0x001a1a1a, 0x001b1b1b, 0x001c1c1c, 0x001d1d1d, 
+0x001e1e1e, 0x001f1f1f, 0x00202020, 0x00212121, 0x00222222, 0x00232323, 
+0x00242424, 0x00252525, 0x00262626, 0x00272727, 0x00282828, 0x00292929, 
+0x002a2a2a, 0x002b2b2b, 0x002c2c2c, 0x002d2d2d, 0x002e2e2e, 0x002f2f2f, 
+0x00303030, 0x00313131, 0x00323232, 0x00333333, 0x00343434, 0x00353535, 
+0x00363636, 0x00373737, 0x00383838, 0x00393939, 0x003a3a3a, 0x003b3b3b, 
+0x003c3c3c, 0x003d3d3d, 0x003e3e3e, 0x003f3f3f, 0x00404040, 0x00414141, 
+0x00424242, 0x00434343, 0x00444444, 0x00454545, 0x00464646, 0x00474747, 
+0x00484848, 0x00494949, 0x004a4a4a, 0x004b4b4b, 0x004c4c4c, 0x004d4d4d, 
+0x004e4e4e, 0x004f4f4f, 0x00505050, 0x00515151, 0x00525252, 0x00535353, 
+0x00545454, 0x00555555, 0x00565656, 0x00575757, 0x00585858, 0x00595959, 
+0x005a5a5a, 0x005b5b5b, 0x005c5c5c, 0x005d5d5d, 0x005e5e5e, 0x005f5f5f, 
+0x00606060, 0x00616161, 0x00626262, 0x00636363, 0x00646464, 0x00656565, 
+0x00666666, 0x00676767, 0x00686868, 0x00696969, 0x006a6a6a, 0x006b6b6b, 
+0x006c6c6c, 0x006d6d6d, 0x006e6e6e, 0x006f6f6f, 0x00707070, 0x00717171, 
+0x00727272, 0x00737373, 0x00747474, 0x00757575, 0x00767676, 0x00777777, 
+0x00787878, 0x00797979, 0x007a7a7a, 0x007b7b7b, 0x007c7c7c, 0x007d7d7d, 
+0x007e7e7e, 0x007f7f7f, 0x00808080, 0x00818181, 0x00828282, 0x00838383, 
+0x00848484, 0x00858585, 0x00868686, 0x00878787, 0x00888888, 0x00898989, 
+0x008a8a8a, 0x008b8b8b, 0x008c8c8c, 0x008d8d8d, 0x008e8e8e, 0x008f8f8f, 
+0x00909090, 0x00919191, 0x00929292, 0x00939393, 0x00949494, 0x00959595, 
+0x00969696, 0x00979797, 0x00989898, 0x00999999, 0x009a9a9a, 0x009b9b9b, 
+0x009c9c9c, 0x009d9d9d, 0x009e9e9e, 0x009f9f9f, 0x00a0a0a0, 0x00a1a1a1, 
+0x00a2a2a2, 0x00a3a3a3, 0x00a4a4a4, 0x00a5a5a5, 0x00a6a6a6, 0x00a7a7a7, 
+0x00a8a8a8, 0x00a9a9a9, 0x00aaaaaa, 0x00ababab, 0x00acacac, 0x00adadad, 
+0x00aeaeae, 0x00afafaf, 0x00b0b0b0, 0x00b1b1b1, 0x00b2b2b2, 0x00b3b3b3, 
+0x00b4b4b4, 0x00b5b5b5, 0x00b6b6b6, 0x00b7b7b7, 0x00b8b8b8, 0x00b9b9b9, 
+0x00bababa, 0x00bbbbbb, 0x00bcbcbc, 0x00bdbdbd, 0x00bebebe, 0x00bfbfbf, 
+0x00c0c0c0, 0x00c1c1c1, 0x00c2c2c2, 0x00c3c3c3, 0x00c4c4c4, 0x00c5c5c5, 
+0x00c6c6c6, 0x00c7c7c7, 0x00c8c8c8, 0x00c9c9c9, 0x00cacaca, 0x00cbcbcb, 
+0x00cccccc, 0x00cdcdcd, 0x00cecece, 0x00cfcfcf, 0x00d0d0d0, 0x00d1d1d1, 
+0x00d2d2d2, 0x00d3d3d3, 0x00d4d4d4, 0x00d5d5d5, 0x00d6d6d6, 0x00d7d7d7, 
+0x00d8d8d8, 0x00d9d9d9, 0x00dadada, 0x00dbdbdb, 0x00dcdcdc, 0x00dddddd, 
+0x00dedede, 0x00dfdfdf, 0x00e0e0e0, 0x00e1e1e1, 0x00e2e2e2, 0x00e3e3e3, 
+0x00e4e4e4, 0x00e5e5e5, 0x00e6e6e6, 0x00e7e7e7, 0x00e8e8e8, 0x00e9e9e9, 
+0x00eaeaea, 0x00ebebeb, 0x00ececec, 0x00ededed, 0x00eeeeee, 0x00efefef, 
+0x00f0f0f0, 0x00f1f1f1, 0x00f2f2f2, 0x00f3f3f3, 0x00f4f4f4, 0x00f5f5f5, 
+0x00f6f6f6, 0x00f7f7f7, 0x00f8f8f8, 0x00f9f9f9, 0x00fafafa, 0x00fbfbfb, 
+0x00fcfcfc, 0x00fdfdfd, 0x00fefefe, 0x00ffffff };
+
+
@@ -0,0 +1,475 @@
+/* RCGL C Graphics Library - Video capture
+ *
+ * Frames are snapshotted by rcgl_update once the composite is drawn and
+ * handed to an encoder thread through a single-producer/single-consumer
+ * ring of preallocated slots. The producer only copies the 8-bit frame and
+ * palette into a free slot and bumps an index, all encoding happens on the
+ * encoder thread. If the encoder falls behind frames are dropped rather
+ * than stalling the caller.
+ *
+ * GIF output is an animated GIF89a with a 256 colour table per palette.
+ * Each frame after the first only stores the rectangle that changed since
+ * the previous one, and frames identical to their predecessor are folded
+ * into its delay. Y4M output is uncompressed 4:4:4 YUV, one frame per update,
+ * declared at the rate the caller says it updates at.
+ *
+ * See rcgl.h for license (BSD 3-Clause).
+ */
+
+#include "rcgl.h"
+#include "rcglint.h"
+#include <SDL2/SDL.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SLOTS       8       // Frames that can be queued for the encoder
+#define HASHBITS    13      // LZW dictionary hash table size
+#define HASHSIZE    (1 << HASHBITS)
+
+struct slot {
+	uint8_t *pix;
+	uint32_t pal[256];
+	uint32_t ticks;
+};
+
+/* GIF LZW encoder state */
+struct lzw {
+	FILE *fp;
+	uint32_t acc;           // Bit accumulator
+	int nacc;
+	uint8_t blk[255];       // Current data sub-block
+	int nblk;
+	int size;               // Current code size in bits
+	int next;               // Next free code
+	uint32_t key[HASHSIZE]; // (prefix << 8 | byte) + 1, 0 if empty
+	uint16_t code[HASHSIZE];
+};
+
+struct rec {
+	FILE *fp;
+	int format;
+	int w, h;
+	int fps;                // Y4M playback rate, the rate of updates
+	int err;
+
+	SDL_Thread *thread;
+	SDL_sem *sem;
+	SDL_atomic_t head;      // Next slot to fill, written by producer
+	SDL_atomic_t tail;      // Next slot to encode, written by encoder
+	SDL_atomic_t stop;
+	int dropped;            // Only touched by producer
+	struct slot slot[SLOTS];
+
+	// Encoder state
+	int nframes;
+	uint8_t *pend;          // Last frame received, not yet written
+	uint32_t pendpal[256];
+	uint32_t pendticks;
+	int px0, py0, px1, py1; // Changed rectangle of pend
+	uint32_t startticks;
+	uint32_t writtencs;     // Centiseconds of delay written so far
+	uint32_t gifpal[256];   // Global colour table
+	struct lzw lzw;         // GIF compressor, this recording's own
+	uint8_t *yuv;           // Y4M plane buffer
+};
+
+static int encoder(void *data);
+
+
+/* PRODUCER SIDE */
+
+/*
+ * rec_start - Open path and start the encoder thread
+ */
+struct rec *rec_start(const char *path, int format, int w, int h, int fps)
+{
+	struct rec *rec;
+
+	if (format != RCGL_REC_GIF && format != RCGL_REC_Y4M) {
+		fprintf(stderr, "RCGL: Unknown recording format %d\n", format);
+		return NULL;
+	}
+	if (fps <= 0) {
+		fprintf(stderr, "RCGL: Can't record at %d frames a second\n", fps);
+		return NULL;
+	}
+	if ((rec = calloc(1, sizeof(*rec))) == NULL)
+		return NULL;
+	rec->format = format;
+	rec->w = w;
+	rec->h = h;
+	rec->fps = fps;
+
+	for (int i = 0; i < SLOTS; i++)
+		if ((rec->slot[i].pix = malloc(w*h)) == NULL)
+			goto fail;
+	if ((rec->pend = malloc(w*h)) == NULL
+	    || (rec->yuv = malloc(w*h)) == NULL)
+		goto fail;
+
+	if ((rec->fp = fopen(path, "wb")) == NULL) {
+		fprintf(stderr, "RCGL: Failed to create %s\n", path);
+		goto fail;
+	}
+	if ((rec->sem = SDL_CreateSemaphore(0)) == NULL)
+		goto fail;
+	rec->thread = SDL_CreateThread(encoder, "RCGLRecordThread", rec);
+	if (rec->thread == NULL) {
+		fprintf(stderr, "RCGL: Failed to create RCGLRecordThread: %s\n",
+		        SDL_GetError());
+		goto fail;
+	}
+	return rec;
+
+fail:
+	if (rec->sem)
+		SDL_DestroySemaphore(rec->sem);
+	if (rec->fp)
+		fclose(rec->fp);
+	for (int i = 0; i < SLOTS; i++)
+		free(rec->slot[i].pix);
+	free(rec->pend);
+	free(rec->yuv);
+	free(rec);
+	return NULL;
+}
+
+/*
+ * rec_frame - Queue a frame for encoding, dropping it if the queue is full
+ */
+void rec_frame(struct rec *rec, const uint8_t *frame, const uint32_t *pal,
+               uint32_t ticks)
+{
+	unsigned head = SDL_AtomicGet(&rec->head);
+	struct slot *s;
+
+	if (head - (unsigned)SDL_AtomicGet(&rec->tail) >= SLOTS) {
+		rec->dropped++;
+		return;
+	}
+	s = &rec->slot[head % SLOTS];
+	memcpy(s->pix, frame, rec->w * rec->h);
+	memcpy(s->pal, pal, sizeof(s->pal));
+	s->ticks = ticks;
+
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicSet(&rec->head, head + 1);
+	SDL_SemPost(rec->sem);
+}
+
+/*
+ * rec_stop - Flush queued frames, close the file and free everything
+ *
+ * Returns the number of frames dropped, or -1 if writing failed.
+ */
+int rec_stop(struct rec *rec)
+{
+	int rval;
+
+	SDL_AtomicSet(&rec->stop, 1);
+	SDL_SemPost(rec->sem);
+	SDL_WaitThread(rec->thread, NULL);
+
+	if (fclose(rec->fp) != 0)
+		rec->err = 1;
+	rval = rec->err ? -1 : rec->dropped;
+
+	SDL_DestroySemaphore(rec->sem);
+	for (int i = 0; i < SLOTS; i++)
+		free(rec->slot[i].pix);
+	free(rec->pend);
+	free(rec->yuv);
+	free(rec);
+	return rval;
+}
+
+
+/* GIF ENCODING */
+
+static void put16(FILE *fp, unsigned v)
+{
+	fputc(v & 0xFF, fp);
+	fputc(v >> 8, fp);
+}
+
+static void putpal(FILE *fp, const uint32_t *pal)
+{
+	uint8_t t[256*3];
+
+	for (int i = 0; i < 256; i++) {
+		t[i*3+0] = pal[i] >> 16;
+		t[i*3+1] = pal[i] >> 8;
+		t[i*3+2] = pal[i];
+	}
+	fwrite(t, 1, sizeof(t), fp);
+}
+
+static void lzwbyte(struct lzw *z, uint8_t b)
+{
+	z->blk[z->nblk++] = b;
+	if (z->nblk == 255) {
+		fputc(255, z->fp);
+		fwrite(z->blk, 1, 255, z->fp);
+		z->nblk = 0;
+	}
+}
+
+static void lzwput(struct lzw *z, int code)
+{
+	z->acc |= (uint32_t)code << z->nacc;
+	z->nacc += z->size;
+	while (z->nacc >= 8) {
+		lzwbyte(z, z->acc);
+		z->acc >>= 8;
+		z->nacc -= 8;
+	}
+}
+
+static void lzwreset(struct lzw *z)
+{
+	memset(z->key, 0, sizeof(z->key));
+	z->size = 9;
+	z->next = 258;
+}
+
+/*
+ * gifpixels - LZW compress a rectangle of the frame as GIF image data
+ */
+static void gifpixels(struct lzw *z, FILE *fp, const uint8_t *pix,
+                      int stride, int x0, int y0, int w, int h)
+{
+	int prefix = -1;
+
+	z->fp = fp;
+	z->acc = 0;
+	z->nacc = 0;
+	z->nblk = 0;
+	lzwreset(z);
+
+	fputc(8, fp);           // Minimum code size
+	lzwput(z, 256);        // Clear
+
+	for (int y = y0; y < y0 + h; y++) {
+		const uint8_t *p = pix + y*stride + x0;
+		for (int x = 0; x < w; x++) {
+			uint32_t key = ((uint32_t)prefix << 8 | p[x]) + 1;
+			uint32_t i;
+
+			if (prefix < 0) {
+				prefix = p[x];
+				continue;
+			}
+			i = (key * 2654435761u) >> (32 - HASHBITS);
+			while (z->key[i] && z->key[i] != key)
+				i = (i + 1) & (HASHSIZE-1);
+			if (z->key[i]) {
+				prefix = z->code[i];
+				continue;
+			}
+
+			lzwput(z, prefix);
+			if (z->next < 4096) {
+				if (z->next == (1 << z->size))
+					z->size++;
+				z->key[i] = key;
+				z->code[i] = z->next++;
+			} else {
+				lzwput(z, 256);
+				lzwreset(z);
+			}
+			prefix = p[x];
+		}
+	}
+	lzwput(z, prefix);
+	lzwput(z, 257);        // End of information
+	if (z->nacc > 0)
+		lzwbyte(z, z->acc);
+	if (z->nblk > 0) {
+		fputc(z->nblk, fp);
+		fwrite(z->blk, 1, z->nblk, fp);
+	}
+	fputc(0, fp);           // Block terminator
+}
+
+/*
+ * gifwrite - Write the pending frame, showing it until ticks
+ */
+static void gifwrite(struct rec *rec, uint32_t ticks)
+{
+	FILE *fp = rec->fp;
+	int local = memcmp(rec->pendpal, rec->gifpal, sizeof(rec->gifpal)) != 0;
+	uint32_t cs = (ticks - rec->startticks) / 10;
+	uint32_t delay;
+
+	// Keep the running total in step with real time, but never ask for
+	// under 2cs which viewers treat as "as slow as they like"
+	delay = cs > rec->writtencs ? cs - rec->writtencs : 0;
+	if (delay < 2)
+		delay = 2;
+	rec->writtencs += delay;
+
+	fputc(0x21, fp);        // Graphic control extension
+	fputc(0xF9, fp);
+	fputc(4, fp);
+	fputc(1 << 2, fp);      // Leave in place, following frames are deltas
+	put16(fp, delay);
+	fputc(0, fp);
+	fputc(0, fp);
+
+	fputc(0x2C, fp);        // Image descriptor
+	put16(fp, rec->px0);
+	put16(fp, rec->py0);
+	put16(fp, rec->px1 - rec->px0);
+	put16(fp, rec->py1 - rec->py0);
+	fputc(local ? 0x87 : 0x00, fp);
+	if (local)
+		putpal(fp, rec->pendpal);
+
+	gifpixels(&rec->lzw, fp, rec->pend, rec->w, rec->px0, rec->py0,
+	          rec->px1 - rec->px0, rec->py1 - rec->py0);
+}
+
+/*
+ * gifframe - Take a new frame, writing out the previous one now its
+ * duration is known
+ */
+static void gifframe(struct rec *rec, const struct slot *s)
+{
+	FILE *fp = rec->fp;
+	int x0 = rec->w, y0 = rec->h, x1 = 0, y1 = 0;
+
+	if (rec->nframes == 0) {
+		memcpy(rec->gifpal, s->pal, sizeof(rec->gifpal));
+		fwrite("GIF89a", 1, 6, fp);
+		put16(fp, rec->w);
+		put16(fp, rec->h);
+		fputc(0xF7, fp);    // Global colour table, 256 entries
+		fputc(0, fp);
+		fputc(0, fp);
+		putpal(fp, rec->gifpal);
+
+		fputc(0x21, fp);    // Loop forever
+		fputc(0xFF, fp);
+		fputc(11, fp);
+		fwrite("NETSCAPE2.0", 1, 11, fp);
+		fputc(3, fp);
+		fputc(1, fp);
+		put16(fp, 0);
+		fputc(0, fp);
+
+		x0 = y0 = 0;
+		x1 = rec->w;
+		y1 = rec->h;
+		rec->startticks = s->ticks;
+	} else if (memcmp(s->pal, rec->pendpal, sizeof(s->pal)) != 0) {
+		x0 = y0 = 0;    // New colours, every pixel has to be resent
+		x1 = rec->w;
+		y1 = rec->h;
+	} else {
+		for (int y = 0; y < rec->h; y++) {
+			const uint8_t *a = s->pix + y*rec->w, *b = rec->pend + y*rec->w;
+			int l, r;
+
+			if (memcmp(a, b, rec->w) == 0)
+				continue;
+			for (l = 0; a[l] == b[l]; l++)
+				;
+			for (r = rec->w; a[r-1] == b[r-1]; r--)
+				;
+			if (y < y0)
+				y0 = y;
+			y1 = y+1;
+			if (l < x0)
+				x0 = l;
+			if (r > x1)
+				x1 = r;
+		}
+		if (y0 >= y1)
+			return;     // Nothing changed, fold into the pending delay
+	}
+
+	if (rec->nframes > 0)
+		gifwrite(rec, s->ticks);
+
+	memcpy(rec->pend, s->pix, rec->w * rec->h);
+	memcpy(rec->pendpal, s->pal, sizeof(rec->pendpal));
+	rec->pendticks = s->ticks;
+	rec->px0 = x0;
+	rec->py0 = y0;
+	rec->px1 = x1;
+	rec->py1 = y1;
+	rec->nframes++;
+}
+
+static void gifend(struct rec *rec)
+{
+	if (rec->nframes > 0) {
+		gifwrite(rec, rec->pendticks + 100);
+		fputc(0x3B, rec->fp);   // Trailer
+	}
+}
+
+
+/* Y4M ENCODING */
+
+static void y4mframe(struct rec *rec, const struct slot *s)
+{
+	uint8_t lut[3][256];
+	int n = rec->w * rec->h;
+
+	if (rec->nframes++ == 0)
+		fprintf(rec->fp, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",
+		        rec->w, rec->h, rec->fps);
+
+	// BT.601 studio range
+	for (int i = 0; i < 256; i++) {
+		int r = (s->pal[i] >> 16) & 0xFF;
+		int g = (s->pal[i] >> 8) & 0xFF;
+		int b = s->pal[i] & 0xFF;
+		lut[0][i] = ((66*r + 129*g + 25*b + 128) >> 8) + 16;
+		lut[1][i] = ((-38*r - 74*g + 112*b + 128) >> 8) + 128;
+		lut[2][i] = ((112*r - 94*g - 18*b + 128) >> 8) + 128;
+	}
+
+	fputs("FRAME\n", rec->fp);
+	for (int p = 0; p < 3; p++) {
+		for (int i = 0; i < n; i++)
+			rec->yuv[i] = lut[p][s->pix[i]];
+		fwrite(rec->yuv, 1, n, rec->fp);
+	}
+}
+
+
+/* ENCODER THREAD */
+
+static int encoder(void *data)
+{
+	struct rec *rec = data;
+	int stop;
+
+	do {
+		SDL_SemWait(rec->sem);
+		stop = SDL_AtomicGet(&rec->stop);
+
+		// Encode everything queued so far
+		while (SDL_AtomicGet(&rec->tail) != SDL_AtomicGet(&rec->head)) {
+			unsigned tail = SDL_AtomicGet(&rec->tail);
+			SDL_MemoryBarrierAcquire();
+
+			if (rec->format == RCGL_REC_GIF)
+				gifframe(rec, &rec->slot[tail % SLOTS]);
+			else
+				y4mframe(rec, &rec->slot[tail % SLOTS]);
+
+			SDL_AtomicSet(&rec->tail, tail + 1);
+		}
+	} while (!stop);
+
+	if (rec->format == RCGL_REC_GIF)
+		gifend(rec);
+	if (ferror(rec->fp))
+		rec->err = 1;
+	return 0;
+}
@@ -0,0 +1,268 @@
+/* RCGL C Graphics Library - Shared-memory frame publishing
+ *
+ * A published context composites straight into a POSIX shared-memory
+ * segment, so other processes can map it read-only and show the same frames
+ * without running the program themselves (see rcglview.c).
+ *
+ * The segment is a header followed by the w*h composite. Frames are guarded
+ * by a sequence lock: rcgl_ctx_update makes seq odd before compositing and
+ * even again once the frame number, dirty rows and palette are filled in, on
+ * whichever thread called it.
+ * Readers copy what they need and retry if seq moved underneath them, so a
+ * slow or stuck viewer can never hold up the program.
+ *
+ * See rcgl.h for license (BSD 3-Clause).
+ */
+
+#include "rcgl.h"
+#include "rcglint.h"
+#include <SDL2/SDL.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SHM_MAGIC   0x4D534352  // "RCSM"
+#define SHM_RETRIES 4           // Torn reads before giving up on a frame
+
+struct shmhdr {
+	uint32_t magic;             // Written last, once the segment is ready
+	uint16_t w, h;
+	SDL_atomic_t seq;           // Odd while a frame is being written
+	uint32_t frame;             // Frames published
+	uint32_t palgen;            // Bumped whenever the palette changes
+	uint16_t dirty0, dirty1;    // Rows [dirty0, dirty1) changed by this frame
+	uint32_t palette[256];
+	uint8_t pad[40];            // Pixels start on a cache line
+};
+
+struct shm {
+	char name[64];
+	struct shmhdr *hdr;
+	size_t size;
+	int newpal;                 // Palette not yet written to the segment
+};
+
+struct rcgl_shm {
+	const struct shmhdr *hdr;
+	size_t size;
+	uint32_t frame;             // Last frame read
+	uint32_t palgen;
+	int fresh;                  // Nothing read yet
+};
+
+
+/* PUBLISHING, called by rcgl.c */
+
+/*
+ * shm_create - Create and map a segment for a w*h context
+ *
+ * *pixels is set to where the composite should be drawn. The header holds
+ * w and h in 16 bits, so neither can be over 65535.
+ */
+struct shm *shm_create(const char *name, int w, int h, uint8_t **pixels)
+{
+	struct shm *s;
+	int fd;
+
+	if (w < 1 || h < 1 || w > UINT16_MAX || h > UINT16_MAX) {
+		fprintf(stderr, "RCGL: Can't publish a %dx%d context\n", w, h);
+		return NULL;
+	}
+
+	if ((s = calloc(1, sizeof(*s))) == NULL) {
+		fprintf(stderr, "RCGL: Failed to allocate segment\n");
+		return NULL;
+	}
+	snprintf(s->name, sizeof(s->name), "%s", name);
+	s->size = sizeof(struct shmhdr) + (size_t)w*h;
+	s->newpal = 1;
+
+	fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "RCGL: Failed to create segment %s\n", name);
+		goto failopen;
+	}
+	if (ftruncate(fd, s->size) < 0) {
+		fprintf(stderr, "RCGL: Failed to size segment %s\n", name);
+		goto failmap;
+	}
+	s->hdr = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (s->hdr == MAP_FAILED) {
+		fprintf(stderr, "RCGL: Failed to map segment %s\n", name);
+		goto failmap;
+	}
+	close(fd);
+
+	s->hdr->w = w;
+	s->hdr->h = h;
+	SDL_MemoryBarrierRelease();
+	s->hdr->magic = SHM_MAGIC;
+	*pixels = (uint8_t *)(s->hdr + 1);
+	return s;
+
+failmap:
+	close(fd);
+	shm_unlink(name);
+failopen:
+	free(s);
+	return NULL;
+}
+
+/*
+ * shm_begin - Mark a frame as being written
+ */
+void shm_begin(struct shm *s)
+{
+	SDL_AtomicAdd(&s->hdr->seq, 1);
+	SDL_MemoryBarrierRelease();
+}
+
+/*
+ * shm_end - Finish a frame that changed rows [y0, y1)
+ */
+void shm_end(struct shm *s, int y0, int y1, const uint32_t *pal, int palchanged)
+{
+	struct shmhdr *hdr = s->hdr;
+
+	if (palchanged || s->newpal) {
+		memcpy(hdr->palette, pal, sizeof(hdr->palette));
+		hdr->palgen++;
+		s->newpal = 0;
+	}
+	hdr->dirty0 = y0;
+	hdr->dirty1 = y1;
+	hdr->frame++;
+	SDL_MemoryBarrierRelease();
+	SDL_AtomicAdd(&hdr->seq, 1);
+}
+
+/*
+ * shm_destroy - Unmap and remove a segment
+ *
+ * Viewers that still have it mapped keep the last frame.
+ */
+void shm_destroy(struct shm *s)
+{
+	munmap(s->hdr, s->size);
+	shm_unlink(s->name);
+	free(s);
+}
+
+
+/* VIEWING */
+
+/*
+ * rcgl_shm_open - Map a segment published by another process, read-only
+ *
+ * Returns NULL if it does not exist (yet). w and h are set to its size.
+ */
+struct rcgl_shm *rcgl_shm_open(const char *name, int *w, int *h)
+{
+	struct rcgl_shm *s;
+	struct stat st;
+	int fd;
+
+	if ((fd = shm_open(name, O_RDONLY, 0)) < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct shmhdr)) {
+		close(fd);
+		return NULL;
+	}
+	if ((s = calloc(1, sizeof(*s))) == NULL) {
+		close(fd);
+		return NULL;
+	}
+	s->size = st.st_size;
+	s->hdr = mmap(NULL, s->size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (s->hdr == MAP_FAILED) {
+		free(s);
+		return NULL;
+	}
+	if (s->hdr->magic != SHM_MAGIC
+	    || sizeof(struct shmhdr) + (size_t)s->hdr->w*s->hdr->h > s->size) {
+		fprintf(stderr, "RCGL: %s is not an rcgl segment\n", name);
+		rcgl_shm_close(s);
+		return NULL;
+	}
+	SDL_MemoryBarrierAcquire();
+	s->fresh = 1;
+	*w = s->hdr->w;
+	*h = s->hdr->h;
+	return s;
+}
+
+/*
+ * rcgl_shm_read - Copy the latest frame into buf, if there is a new one
+ *
+ * Only rows changed since the last read are copied, their span is returned
+ * in y0 and y1. pal is filled in when the palette changes. Never waits for
+ * the publisher, if a frame is being written it is left for the next call.
+ *
+ * Returns RCGL_SHM_FRAME and/or RCGL_SHM_PALETTE for what was updated, or
+ * 0 if nothing was.
+ */
+int rcgl_shm_read(struct rcgl_shm *s, uint8_t *buf, uint32_t pal[256],
+                  int *y0, int *y1)
+{
+	const struct shmhdr *hdr = s->hdr;
+	const uint8_t *pix = (const uint8_t *)(hdr + 1);
+	int w = hdr->w, h = hdr->h;
+	unsigned seq;
+	uint32_t frame, palgen;
+	int rval, d0, d1;
+
+	for (int tries = 0; tries < SHM_RETRIES; tries++) {
+		seq = SDL_AtomicGet((SDL_atomic_t *)&hdr->seq);
+		if (seq & 1)
+			continue;
+		SDL_MemoryBarrierAcquire();
+		frame = hdr->frame;
+		palgen = hdr->palgen;
+		if (!s->fresh && frame == s->frame && palgen == s->palgen)
+			return 0;
+		rval = 0;
+		if (s->fresh || palgen != s->palgen) {
+			memcpy(pal, hdr->palette, sizeof(hdr->palette));
+			rval |= RCGL_SHM_PALETTE;
+		}
+		// Missed frames mean missed dirty rows, so take it all
+		if (s->fresh || frame != s->frame + 1) {
+			d0 = 0;
+			d1 = h;
+		} else {
+			d0 = hdr->dirty0;
+			d1 = hdr->dirty1;
+			if (d1 > h)
+				d1 = h;
+		}
+		if (d0 < d1)
+			memcpy(buf + d0*w, pix + d0*w, (size_t)(d1 - d0)*w);
+		if (frame != s->frame || s->fresh)
+			rval |= RCGL_SHM_FRAME;
+		SDL_MemoryBarrierAcquire();
+		if ((unsigned)SDL_AtomicGet((SDL_atomic_t *)&hdr->seq) != seq)
+			continue;
+		s->frame = frame;
+		s->palgen = palgen;
+		s->fresh = 0;
+		*y0 = d0;
+		*y1 = d1;
+		return rval;
+	}
+	return 0;
+}
+
+/*
+ * rcgl_shm_close - Unmap a segment
+ */
+void rcgl_shm_close(struct rcgl_shm *s)
+{
+	munmap((void *)s->hdr, s->size);
+	free(s);
+}
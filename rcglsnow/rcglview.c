@@ -0,0 +1,74 @@
+/* RCGLVIEW - Show frames published by another rcgl program
+ *
+ * Maps a shared-memory segment made with rcgl_publish read-only and puts its
+ * frames on screen through rcgl as they arrive. Any number of viewers can
+ * watch one program, and none of them can slow it down.
+ *
+ * usage: rcglview [-s scale] name
+ *   name  Segment the program publishes to, e.g. /snow
+ *   -s    Integer window scale, 4 by default
+ *
+ * Press Escape or close the window to quit.
+ */
+#include "rcgl.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+int main(int argc, char **argv)
+{
+	struct rcgl_shm *shm;
+	struct rcgl_event ev;
+	uint32_t pal[256];
+	int w, h, y0, y1;
+	int scale = 4;
+	int got, opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+		case 's':
+			scale = atoi(optarg);
+			break;
+		default:
+			goto usage;
+		}
+	}
+	if (optind != argc-1 || scale < 1) {
+usage:
+		fprintf(stderr, "usage: rcglview [-s scale] name\n");
+		return -1;
+	}
+
+	if ((shm = rcgl_shm_open(argv[optind], &w, &h)) == NULL) {
+		fprintf(stderr, "rcglview: Nothing published as %s\n", argv[optind]);
+		return -1;
+	}
+	if (rcgl_init(w, h, w*scale, h*scale, argv[optind],
+	              RCGL_INTSCALE | RCGL_RESIZE) < 0) {
+		rcgl_shm_close(shm);
+		return -1;
+	}
+	// Only rows the publisher changed get redrawn
+	rcgl_setautodirty(0, 0);
+
+	while (!rcgl_hasquit()) {
+		got = rcgl_shm_read(shm, rcgl_getbuf(), pal, &y0, &y1);
+		if (got & RCGL_SHM_PALETTE)
+			rcgl_setpalette(pal);
+		if (got) {
+			rcgl_dirty(0, y0, y1 - y0);
+			rcgl_update();
+		} else {
+			rcgl_delay(1);
+		}
+
+		while (rcgl_poll_event(&ev))
+			if (ev.type == RCGL_KEYDOWN && ev.key == RCGL_KEY_ESCAPE)
+				goto done;
+	}
+
+done:
+	rcgl_quit();
+	rcgl_shm_close(shm);
+	return 0;
+}
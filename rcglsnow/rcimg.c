@@ -0,0 +1,327 @@
+/* RCIMG - Truecolor image import for RCGL
+ *
+ * See rcimg.h for usage, and rcgl.h for license (BSD 3-Clause).
+ */
+
+#include "rcimg.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SHIFT   (8 - RCIMG_CUBEBITS)
+#define MAXDIM  65535   // Widest or tallest image, as much as TGA can say
+
+/* Decoded source image, rows may run bottom-up (negative stride) */
+struct src {
+	const uint8_t *row0;    // First (top) row
+	long stride;
+	int w, h;
+	int bpp;                // Bytes per pixel, 3 or 4
+	int bgr;                // Channels stored blue first
+};
+
+/* 4x4 Bayer matrix, scaled to cover one cube step when dithering */
+static const uint8_t bayer[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 }
+};
+
+
+/*
+ * rcimg_buildcube - Fill cube with the nearest palette index for each cell
+ *
+ * Each cell is matched on its centre colour. Duplicate palette entries are
+ * skipped so ties always resolve to the lowest index.
+ */
+void rcimg_buildcube(struct rcimg_cube *cube, const uint32_t palette[256])
+{
+	int pr[256], pg[256], pb[256], pi[256];
+	int n = 0;
+
+	for (int i = 0; i < 256; i++) {
+		int j;
+		for (j = 0; j < i; j++)
+			if ((palette[j] & 0xFFFFFF) == (palette[i] & 0xFFFFFF))
+				break;
+		if (j < i)
+			continue;
+		pr[n] = (palette[i] >> 16) & 0xFF;
+		pg[n] = (palette[i] >> 8) & 0xFF;
+		pb[n] = palette[i] & 0xFF;
+		pi[n] = i;
+		n++;
+	}
+
+	for (int r = 0; r < RCIMG_CUBESIZE; r++) {
+		for (int g = 0; g < RCIMG_CUBESIZE; g++) {
+			for (int b = 0; b < RCIMG_CUBESIZE; b++) {
+				int cr = (r << SHIFT) + (1 << SHIFT)/2;
+				int cg = (g << SHIFT) + (1 << SHIFT)/2;
+				int cb = (b << SHIFT) + (1 << SHIFT)/2;
+				int best = 0, bestd = 0x7FFFFFFF;
+
+				for (int k = 0; k < n; k++) {
+					int dr = pr[k] - cr, dg = pg[k] - cg, db = pb[k] - cb;
+					int d = dr*dr + dg*dg + db*db;
+					if (d < bestd) {
+						bestd = d;
+						best = pi[k];
+					}
+				}
+				cube->map[(r << (2*RCIMG_CUBEBITS))
+				          | (g << RCIMG_CUBEBITS) | b] = best;
+			}
+		}
+	}
+}
+
+/*
+ * dither - Add the ordered dither pattern for row y to a row of RGB bytes
+ *
+ * Kept as a flat saturating add over bytes so the compiler turns it into
+ * packed unsigned adds.
+ */
+static void dither(uint8_t *rgb, const uint8_t *pat, int n)
+{
+	for (int i = 0; i < n; i++) {
+		unsigned v = rgb[i] + pat[i];
+		rgb[i] = v > 255 ? 255 : v;
+	}
+}
+
+/*
+ * lookup - Map a row of RGB bytes through the cube
+ */
+static void lookup(uint8_t *dst, const uint8_t *rgb, int w,
+                   const struct rcimg_cube *cube)
+{
+	for (int x = 0; x < w; x++, rgb += 3)
+		dst[x] = cube->map[((rgb[0] >> SHIFT) << (2*RCIMG_CUBEBITS))
+		                   | ((rgb[1] >> SHIFT) << RCIMG_CUBEBITS)
+		                   | (rgb[2] >> SHIFT)];
+}
+
+/*
+ * mkpattern - Expand the Bayer matrix into 4 rows of per-byte offsets
+ */
+static uint8_t *mkpattern(int w)
+{
+	uint8_t *pat = malloc(4 * w * 3);
+
+	if (pat == NULL)
+		return NULL;
+	for (int y = 0; y < 4; y++)
+		for (int x = 0; x < w; x++)
+			memset(pat + (y*w + x)*3, bayer[y][x & 3] >> (4 - SHIFT), 3);
+	return pat;
+}
+
+
+/* FILE FORMAT PARSERS */
+
+static uint32_t le16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*
+ * fits - Whether s is a sensible size and its rows, from off on, are in the
+ * len bytes of the file
+ *
+ * Divides rather than multiplies so nothing can overflow, and once the
+ * pixels are known to be in the file w*h can't either.
+ */
+static int fits(const struct src *s, unsigned long off, long len)
+{
+	if (s->w <= 0 || s->w > MAXDIM || s->h <= 0 || s->h > MAXDIM
+	    || off > (unsigned long)len)
+		return 0;
+	return (unsigned long)s->stride <= ((unsigned long)len - off) / s->h;
+}
+
+/*
+ * parsebmp - Uncompressed 24 or 32-bit Windows bitmap
+ */
+static int parsebmp(struct src *s, const uint8_t *d, long len)
+{
+	uint32_t off, comp;
+	int32_t h;
+
+	if (len < 54 || d[0] != 'B' || d[1] != 'M')
+		return -1;
+	off = le32(d + 10);
+	s->w = (int32_t)le32(d + 18);
+	h = (int32_t)le32(d + 22);
+	s->bpp = le16(d + 28) / 8;
+	comp = le32(d + 30);
+	// BI_RGB, or BI_BITFIELDS which 32-bit writers use for plain BGRA
+	if ((s->bpp != 3 && s->bpp != 4) || (comp != 0 && comp != 3))
+		return -1;
+	s->bgr = 1;
+	if (h == INT32_MIN || s->w <= 0 || s->w > MAXDIM)
+		return -1;
+	s->h = h < 0 ? -h : h;
+	s->stride = ((long)s->w * s->bpp + 3) & ~3L;
+	if (!fits(s, off, len))
+		return -1;
+	if (h > 0) {    // Bottom-up
+		s->row0 = d + off + s->stride * (s->h - 1);
+		s->stride = -s->stride;
+	} else {
+		s->row0 = d + off;
+	}
+	return 0;
+}
+
+/*
+ * parsetga - Uncompressed truecolor (type 2) Targa
+ */
+static int parsetga(struct src *s, const uint8_t *d, long len)
+{
+	long off;
+
+	if (len < 18 || d[2] != 2)
+		return -1;
+	off = 18 + d[0] + (d[1] ? le16(d + 5) * ((d[7] + 7) / 8) : 0);
+	s->w = le16(d + 12);
+	s->h = le16(d + 14);
+	s->bpp = d[16] / 8;
+	s->bgr = 1;
+	if (s->bpp != 3 && s->bpp != 4)
+		return -1;
+	s->stride = (long)s->w * s->bpp;
+	if (!fits(s, off, len))
+		return -1;
+	if (d[17] & 0x20) {     // Top-left origin
+		s->row0 = d + off;
+	} else {
+		s->row0 = d + off + s->stride * (s->h - 1);
+		s->stride = -s->stride;
+	}
+	return 0;
+}
+
+/*
+ * ppmint - Read a header integer, skipping whitespace and comments
+ */
+static long ppmint(const uint8_t *d, long len, long *pos)
+{
+	long v = 0;
+
+	while (*pos < len) {
+		if (d[*pos] == '#')
+			while (*pos < len && d[*pos] != '\n')
+				(*pos)++;
+		else if (d[*pos] == ' ' || (d[*pos] >= '\t' && d[*pos] <= '\r'))
+			(*pos)++;
+		else
+			break;
+	}
+	if (*pos >= len || d[*pos] < '0' || d[*pos] > '9')
+		return -1;
+	while (*pos < len && d[*pos] >= '0' && d[*pos] <= '9' && v < 0x10000)
+		v = v*10 + d[(*pos)++] - '0';
+	return v;
+}
+
+/*
+ * parseppm - Binary 8-bit Netpbm pixmap
+ */
+static int parseppm(struct src *s, const uint8_t *d, long len)
+{
+	long pos = 2;
+	long maxval;
+
+	if (len < 3 || d[0] != 'P' || d[1] != '6')
+		return -1;
+	s->w = ppmint(d, len, &pos);
+	s->h = ppmint(d, len, &pos);
+	maxval = ppmint(d, len, &pos);
+	pos++;  // Single whitespace before the raster
+	if (s->w <= 0 || s->w > MAXDIM || maxval != 255)
+		return -1;
+	s->bpp = 3;
+	s->bgr = 0;
+	s->stride = (long)s->w * 3;
+	s->row0 = d + pos;
+	if (!fits(s, pos, len))
+		return -1;
+	return 0;
+}
+
+/*
+ * rcimg_load - Load an image file and map it onto the palette in cube
+ *
+ * Returns a malloc'd w*h buffer of palette indices, or NULL on failure.
+ */
+uint8_t *rcimg_load(const char *path, const struct rcimg_cube *cube,
+                    int flags, int *w, int *h)
+{
+	struct src s;
+	uint8_t *data = NULL, *img = NULL, *row = NULL, *pat = NULL;
+	FILE *fp;
+	long len;
+
+	if ((fp = fopen(path, "rb")) == NULL) {
+		fprintf(stderr, "RCIMG: Failed to open %s\n", path);
+		return NULL;
+	}
+	fseek(fp, 0, SEEK_END);
+	len = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (len <= 0 || (data = malloc(len)) == NULL
+	    || fread(data, 1, len, fp) != (size_t)len) {
+		fprintf(stderr, "RCIMG: Failed to read %s\n", path);
+		goto done;
+	}
+
+	// TGA has no magic number so try it last
+	if (parsebmp(&s, data, len) < 0 && parseppm(&s, data, len) < 0
+	    && parsetga(&s, data, len) < 0) {
+		fprintf(stderr, "RCIMG: %s is not an uncompressed BMP, TGA or PPM\n",
+		        path);
+		goto done;
+	}
+
+	img = malloc((size_t)s.w * s.h);
+	row = malloc((size_t)s.w * 3);
+	if ((flags & RCIMG_DITHER) && (pat = mkpattern(s.w)) == NULL)
+		flags &= ~RCIMG_DITHER;
+	if (img == NULL || row == NULL) {
+		fprintf(stderr, "RCIMG: Out of memory loading %s\n", path);
+		free(img);
+		img = NULL;
+		goto done;
+	}
+
+	for (int y = 0; y < s.h; y++) {
+		const uint8_t *p = s.row0 + s.stride * y;
+		uint8_t *q = row;
+		int ri = s.bgr ? 2 : 0, bi = s.bgr ? 0 : 2;
+
+		for (int x = 0; x < s.w; x++, p += s.bpp, q += 3) {
+			q[0] = p[ri];
+			q[1] = p[1];
+			q[2] = p[bi];
+		}
+		if (flags & RCIMG_DITHER)
+			dither(row, pat + (y & 3)*s.w*3, s.w * 3);
+		lookup(img + (size_t)y * s.w, row, s.w, cube);
+	}
+	*w = s.w;
+	*h = s.h;
+
+done:
+	fclose(fp);
+	free(data);
+	free(row);
+	free(pat);
+	return img;
+}
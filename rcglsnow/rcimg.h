@@ -0,0 +1,31 @@
+/* RCIMG - Truecolor image import for RCGL
+ *
+ * Loads uncompressed BMP (24/32-bit), TGA (type 2, 24/32-bit) and binary PPM
+ * (P6, 8-bit) images and maps every pixel onto a 256 colour palette. The
+ * mapping goes through a 32x32x32 lookup cube of nearest palette indices
+ * which is built once per palette, after that a pixel costs one table read.
+ *
+ * With RCIMG_DITHER a 4x4 ordered dither is added before the lookup to hide
+ * the banding of the 5-bit-per-channel cube.
+ *
+ * See rcgl.h for license (BSD 3-Clause).
+ */
+#ifndef RCIMG_H
+#define RCIMG_H
+
+#include <stdint.h>
+
+#define RCIMG_DITHER    1
+
+#define RCIMG_CUBEBITS  5
+#define RCIMG_CUBESIZE  (1 << RCIMG_CUBEBITS)
+
+struct rcimg_cube {
+	uint8_t map[RCIMG_CUBESIZE * RCIMG_CUBESIZE * RCIMG_CUBESIZE];
+};
+
+void rcimg_buildcube(struct rcimg_cube *cube, const uint32_t palette[256]);
+uint8_t *rcimg_load(const char *path, const struct rcimg_cube *cube,
+                    int flags, int *w, int *h);
+
+#endif
@@ -0,0 +1,334 @@
+/* RCMETRICS - Counters and gauges for RCGL programs, exported for Prometheus
+ *
+ * See rcmetrics.h, and rcgl.h for license (BSD 3-Clause).
+ */
+
+#include "rcmetrics.h"
+#include <SDL2/SDL.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define NAMELEN     48
+#define HELPLEN     80
+#define TEXTLEN     (RCMETRICS_MAX * (2*NAMELEN + HELPLEN + 64))
+
+struct metric {
+	char name[NAMELEN];
+	char help[HELPLEN];
+	int type;
+};
+
+/* One thread's counters, a cache line apart from the next thread's */
+struct shard {
+	_Alignas(64) _Atomic uint64_t v[RCMETRICS_MAX];
+};
+
+static struct metric metrics[RCMETRICS_MAX];
+static SDL_atomic_t nmetrics;          // Set once a metric is filled in
+static SDL_SpinLock newlock;
+
+static struct shard shards[RCMETRICS_THREADS];
+static SDL_atomic_t nshards;
+static _Thread_local struct shard *mine;
+static _Atomic uint64_t gauges[RCMETRICS_MAX];  // Bits of a double
+
+/* The exporter */
+static SDL_Thread *thread;
+static SDL_sem *wake;
+static SDL_atomic_t stop;
+static char *path;                     // File, or the socket's path
+static char *tmp;                      // Where the file is written first
+static int sock = -1;                  // Listening, if exporting to a socket
+static int period;                     // ms between files
+static char text[TEXTLEN];             // Exporter thread only
+
+
+/*
+ * rcmetrics_new - Register a metric, or find the one already called name
+ *
+ * name and help follow the Prometheus conventions, counters end in _total.
+ * Returns the id to count with, -1 if there are too many.
+ */
+int rcmetrics_new(const char *name, int type, const char *help)
+{
+	int i, n;
+
+	SDL_AtomicLock(&newlock);
+	n = SDL_AtomicGet(&nmetrics);
+	for (i = 0; i < n && strcmp(metrics[i].name, name) != 0; i++)
+		;
+	if (i == n) {
+		if (n < RCMETRICS_MAX && strlen(name) < NAMELEN) {
+			strcpy(metrics[i].name, name);
+			snprintf(metrics[i].help, HELPLEN, "%s", help);
+			metrics[i].type = type;
+			SDL_AtomicSet(&nmetrics, n + 1);
+		} else {
+			fprintf(stderr, "RCMETRICS: No room for %s\n", name);
+			i = -1;
+		}
+	}
+	SDL_AtomicUnlock(&newlock);
+	return i;
+}
+
+/*
+ * rcmetrics_add - Add n to a counter, or n ns to a seconds counter
+ */
+void rcmetrics_add(int id, uint64_t n)
+{
+	if (id < 0)
+		return;
+	if (mine == NULL) {
+		int i = SDL_AtomicAdd(&nshards, 1);
+		mine = &shards[i < RCMETRICS_THREADS ? i : RCMETRICS_THREADS-1];
+	}
+	atomic_fetch_add_explicit(&mine->v[id], n, memory_order_relaxed);
+}
+
+/*
+ * rcmetrics_set - Set a gauge
+ */
+void rcmetrics_set(int id, double v)
+{
+	uint64_t bits;
+
+	if (id < 0)
+		return;
+	memcpy(&bits, &v, sizeof(bits));
+	atomic_store_explicit(&gauges[id], bits, memory_order_relaxed);
+}
+
+/*
+ * rcmetrics_format - Put every metric in buf in the Prometheus text format
+ *
+ * Counters are summed over the threads' shards as they are read, each is
+ * exact but they aren't all from the same instant. Returns the length of
+ * the text, which is cut short, still NUL terminated, if len isn't enough.
+ */
+size_t rcmetrics_format(char *buf, size_t len)
+{
+	static const char *types[] = { "counter", "gauge", "counter" };
+	int n = SDL_AtomicGet(&nmetrics), ns = SDL_AtomicGet(&nshards);
+	size_t off = 0;
+	uint64_t sum;
+	double v;
+
+	if (ns > RCMETRICS_THREADS)
+		ns = RCMETRICS_THREADS;
+	if (len > 0)
+		buf[0] = '\0';
+	for (int i = 0; i < n; i++) {
+		const struct metric *m = &metrics[i];
+		char *p = off < len ? buf + off : NULL;
+		size_t left = off < len ? len - off : 0;
+
+		off += snprintf(p, left, "# HELP %s %s\n# TYPE %s %s\n", m->name,
+		                m->help, m->name, types[m->type]);
+		p = off < len ? buf + off : NULL;
+		left = off < len ? len - off : 0;
+		if (m->type == RCMETRICS_GAUGE) {
+			sum = atomic_load_explicit(&gauges[i], memory_order_relaxed);
+			memcpy(&v, &sum, sizeof(v));
+			off += snprintf(p, left, "%s %.15g\n", m->name, v);
+			continue;
+		}
+		sum = 0;
+		for (int s = 0; s < ns; s++)
+			sum += atomic_load_explicit(&shards[s].v[i],
+			                            memory_order_relaxed);
+		if (m->type == RCMETRICS_SECONDS)
+			off += snprintf(p, left, "%s %.9f\n", m->name, sum / 1e9);
+		else
+			off += snprintf(p, left, "%s %llu\n", m->name,
+			                (unsigned long long)sum);
+	}
+	return off;
+}
+
+/*
+ * save - Replace the metrics file, scrapers see the old one or the new one
+ */
+static void save(void)
+{
+	static int failed;
+	size_t n = rcmetrics_format(text, sizeof(text));
+	FILE *fp;
+
+	if (n >= sizeof(text))
+		n = sizeof(text) - 1;
+	if ((fp = fopen(tmp, "w")) == NULL
+	    || (fwrite(text, 1, n, fp) != n) + (fclose(fp) != 0)
+	    || rename(tmp, path) != 0) {
+		if (!failed)
+			fprintf(stderr, "RCMETRICS: Failed to write %s\n", path);
+		failed = 1;
+		return;
+	}
+	failed = 0;
+}
+
+/*
+ * sendall - Send n bytes of buf, returns -1 if the other end has gone
+ *
+ * MSG_NOSIGNAL so a scraper hanging up early can't SIGPIPE the display.
+ */
+static int sendall(int fd, const char *buf, size_t n)
+{
+	ssize_t k;
+
+	while (n > 0) {
+		if ((k = send(fd, buf, n, MSG_NOSIGNAL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += k;
+		n -= k;
+	}
+	return 0;
+}
+
+/*
+ * serve - Answer whoever connects to the socket in the next period
+ *
+ * The answer is a bare HTTP response, so curl --unix-socket or a scraper
+ * reaching it through a proxy can read it, and nc -U shows it as well.
+ */
+static void serve(void)
+{
+	static int failed;
+	struct pollfd pfd = { sock, POLLIN, 0 };
+	char req[512], head[128];
+	size_t n;
+	int fd, k;
+
+	if (poll(&pfd, 1, period) <= 0 || (fd = accept(sock, NULL, NULL)) < 0)
+		return;
+	// Take the request, if there is one, so closing doesn't reset it
+	pfd = (struct pollfd){ fd, POLLIN, 0 };
+	if (poll(&pfd, 1, 100) <= 0 || read(fd, req, sizeof(req)) >= 0) {
+		n = rcmetrics_format(text, sizeof(text));
+		if (n >= sizeof(text))
+			n = sizeof(text) - 1;
+		k = snprintf(head, sizeof(head), "HTTP/1.0 200 OK\r\nContent-Type: "
+		             "text/plain; version=0.0.4\r\nContent-Length: %zu\r\n"
+		             "\r\n", n);
+		// Nothing to be done about a scraper that hangs up, but say so
+		if (sendall(fd, head, k) < 0 || sendall(fd, text, n) < 0) {
+			if (!failed)
+				fprintf(stderr, "RCMETRICS: Failed to answer on %s\n",
+				        path);
+			failed = 1;
+		} else {
+			failed = 0;
+		}
+	}
+	close(fd);
+}
+
+static int exporter(void *data)
+{
+	(void)data;
+	while (!SDL_AtomicGet(&stop)) {
+		if (sock >= 0) {
+			serve();
+		} else {
+			save();
+			SDL_SemWaitTimeout(wake, period);
+		}
+	}
+	return 0;
+}
+
+/*
+ * rcmetrics_start - Export the metrics every ms milliseconds until stopped
+ *
+ * where is a file, or unix:/path for a socket, which is answered as soon as
+ * anything connects. Returns 0 on success, -1 on failure.
+ */
+int rcmetrics_start(const char *where, int ms)
+{
+	struct sockaddr_un addr;
+	int onsock = strncmp(where, "unix:", 5) == 0;
+
+	if (thread)
+		return -1;
+	period = ms;
+	if ((path = strdup(onsock ? where+5 : where)) == NULL)
+		return -1;
+	if (onsock) {
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if (strlen(path) >= sizeof(addr.sun_path)) {
+			fprintf(stderr, "RCMETRICS: Socket path %s is too long\n", path);
+			goto fail;
+		}
+		strcpy(addr.sun_path, path);
+		unlink(path);
+		if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) < 0
+		    || bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0
+		    || listen(sock, 4) < 0) {
+			fprintf(stderr, "RCMETRICS: Failed to listen on %s\n", path);
+			goto fail;
+		}
+	} else {
+		if ((tmp = malloc(strlen(path) + 5)) == NULL)
+			goto fail;
+		sprintf(tmp, "%s.new", path);
+	}
+	SDL_AtomicSet(&stop, 0);
+	if ((wake = SDL_CreateSemaphore(0)) == NULL)
+		goto fail;
+	thread = SDL_CreateThread(exporter, "RCMetricsThread", NULL);
+	if (thread == NULL) {
+		fprintf(stderr, "RCMETRICS: Failed to create RCMetricsThread: %s\n",
+		        SDL_GetError());
+		goto fail;
+	}
+	return 0;
+
+fail:
+	if (wake)
+		SDL_DestroySemaphore(wake);
+	wake = NULL;
+	if (sock >= 0)
+		close(sock);
+	sock = -1;
+	free(path);
+	free(tmp);
+	path = tmp = NULL;
+	return -1;
+}
+
+/*
+ * rcmetrics_stop - Stop exporting, a file gets the final counts
+ */
+void rcmetrics_stop(void)
+{
+	if (thread == NULL)
+		return;
+	SDL_AtomicSet(&stop, 1);
+	SDL_SemPost(wake);
+	SDL_WaitThread(thread, NULL);
+	thread = NULL;
+	SDL_DestroySemaphore(wake);
+	wake = NULL;
+	if (sock >= 0) {
+		close(sock);
+		unlink(path);
+		sock = -1;
+	} else {
+		save();
+	}
+	free(path);
+	free(tmp);
+	path = tmp = NULL;
+}
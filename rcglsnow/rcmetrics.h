@@ -0,0 +1,42 @@
+/* RCMETRICS - Counters and gauges for RCGL programs, exported for Prometheus
+ *
+ * A metric is registered once by name and then counted by id. Each thread
+ * counts into its own shard of the counters, a cache line apart from the
+ * others, with relaxed atomic adds, so counting never contends or waits on
+ * the exporter. Gauges are a single value, the last set wins. SDL's atomics
+ * are 32-bit and fully ordered, these use C11 ones.
+ *
+ * rcmetrics_start runs a thread that sums the shards every so often and
+ * writes them out in the Prometheus text format, either to a file, replaced
+ * whole each time so a scraper never reads half of one (node_exporter's
+ * textfile collector), or to anything that connects to a Unix socket, given
+ * as unix:/path.
+ *
+ * Ids from a failed registration are negative, and counting to them does
+ * nothing, so callers needn't check.
+ *
+ * See rcgl.h for license (BSD 3-Clause).
+ */
+#ifndef RCMETRICS_H
+#define RCMETRICS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RCMETRICS_MAX       48  // Metrics that can be registered
+#define RCMETRICS_THREADS   8   // Threads with a shard, more share the last
+
+enum rcmetrics_type {
+	RCMETRICS_COUNTER,
+	RCMETRICS_GAUGE,
+	RCMETRICS_SECONDS       // Counter added to in ns, exported in seconds
+};
+
+int rcmetrics_new(const char *name, int type, const char *help);
+void rcmetrics_add(int id, uint64_t n);
+void rcmetrics_set(int id, double v);
+size_t rcmetrics_format(char *buf, size_t len);
+int rcmetrics_start(const char *where, int ms);
+void rcmetrics_stop(void);
+
+#endif
@@ -0,0 +1,130 @@
+/* RCPAK - Packed asset container for RCGL programs
+ *
+ * See rcpak.h for the file layout, and rcgl.h for license (BSD 3-Clause).
+ */
+
+#include "rcpak.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*
+ * rcpak_open - Map a pack file and validate its index
+ *
+ * Returns 0 on success, negative on failure. On failure pak is left empty.
+ */
+int rcpak_open(struct rcpak *pak, const char *path)
+{
+	const struct rcpak_header *hdr;
+	struct stat st;
+	void *map;
+	int fd;
+
+	memset(pak, 0, sizeof(*pak));
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "RCPAK: Failed to open %s\n", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*hdr)) {
+		fprintf(stderr, "RCPAK: %s is not a pack\n", path);
+		close(fd);
+		return -2;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);  // Mapping holds its own reference
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "RCPAK: Failed to map %s\n", path);
+		return -1;
+	}
+
+	hdr = map;
+	if (memcmp(hdr->magic, RCPAK_MAGIC, 4) != 0
+	    || hdr->version != RCPAK_VERSION
+	    || hdr->count > (st.st_size - sizeof(*hdr)) / sizeof(struct rcpak_entry)) {
+		fprintf(stderr, "RCPAK: %s is not a version %d pack\n",
+		        path, RCPAK_VERSION);
+		munmap(map, st.st_size);
+		return -2;
+	}
+
+	pak->base = map;
+	pak->size = st.st_size;
+	pak->ents = (const struct rcpak_entry *)(pak->base + sizeof(*hdr));
+	pak->count = hdr->count;
+
+	// Reject entries pointing outside the file so lookups never have to
+	for (uint32_t i = 0; i < pak->count; i++) {
+		const struct rcpak_entry *e = &pak->ents[i];
+		if (e->off > pak->size || e->len > pak->size - e->off) {
+			fprintf(stderr, "RCPAK: %s has a corrupt index\n", path);
+			rcpak_close(pak);
+			return -2;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * rcpak_close - Unmap a pack, any asset pointers into it become invalid
+ */
+void rcpak_close(struct rcpak *pak)
+{
+	if (pak->base)
+		munmap((void *)pak->base, pak->size);
+	memset(pak, 0, sizeof(*pak));
+}
+
+/*
+ * rcpak_find - Look up an asset by type and name, NULL if not present
+ */
+const struct rcpak_entry *rcpak_find(const struct rcpak *pak, uint32_t type,
+                                     const char *name)
+{
+	for (uint32_t i = 0; i < pak->count; i++) {
+		const struct rcpak_entry *e = &pak->ents[i];
+		if (e->type == type && strncmp(e->name, name, RCPAK_NAMELEN) == 0)
+			return e;
+	}
+	return NULL;
+}
+
+/*
+ * rcpak_data - Get a pointer to an entry's data inside the mapping
+ */
+const void *rcpak_data(const struct rcpak *pak, const struct rcpak_entry *e)
+{
+	return pak->base + e->off;
+}
+
+/*
+ * rcpak_sprite - Find a sprite, returning its pixels and size
+ */
+const uint8_t *rcpak_sprite(const struct rcpak *pak, const char *name,
+                            int *w, int *h)
+{
+	const struct rcpak_entry *e = rcpak_find(pak, RCPAK_SPRITE, name);
+
+	if (e == NULL || e->len < (uint32_t)e->w * e->h)
+		return NULL;
+	*w = e->w;
+	*h = e->h;
+	return rcpak_data(pak, e);
+}
+
+/*
+ * rcpak_palette - Find a palette, usable directly with rcgl_setpalette
+ */
+const uint32_t *rcpak_palette(const struct rcpak *pak, const char *name)
+{
+	const struct rcpak_entry *e = rcpak_find(pak, RCPAK_PALETTE, name);
+
+	if (e == NULL || e->len < 256 * sizeof(uint32_t))
+		return NULL;
+	return rcpak_data(pak, e);
+}
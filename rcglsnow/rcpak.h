@@ -0,0 +1,70 @@
+/* RCPAK - Packed asset container for RCGL programs
+ *
+ * A pack is a single file holding sprites, palettes and RAD songs behind a
+ * small index. It is mmap'd read-only when opened and every asset is used
+ * straight out of the mapping, nothing is copied or decoded at load time.
+ * Swapping art is then just a matter of dropping in a new pack, no rebuild.
+ *
+ * File layout, all fields little-endian:
+ *   struct rcpak_header
+ *   struct rcpak_entry[header.count]
+ *   asset data, each blob starting on a RCPAK_ALIGN byte boundary
+ *
+ * Asset data:
+ *   RCPAK_SPRITE   w*h bytes of 8-bit palette indices, row major
+ *   RCPAK_PALETTE  256 uint32_t 0x00RRGGBB entries (as RCGL_PALETTE_VGA)
+ *   RCPAK_RAD      raw Reality Adlib Tracker v1.0 file
+ *   RCPAK_SCENE    text scene description, see scene.h
+ *
+ * Packs are built by mkpak, see mkpak.c.
+ *
+ * See rcgl.h for license (BSD 3-Clause).
+ */
+#ifndef RCPAK_H
+#define RCPAK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define RCPAK_MAGIC     "RCPK"
+#define RCPAK_VERSION   1
+#define RCPAK_ALIGN     16
+#define RCPAK_NAMELEN   16
+
+#define RCPAK_SPRITE    1
+#define RCPAK_PALETTE   2
+#define RCPAK_RAD       3
+#define RCPAK_SCENE     4
+
+struct rcpak_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;         // Number of index entries
+	uint32_t reserved;
+};
+
+struct rcpak_entry {
+	char name[RCPAK_NAMELEN];   // NUL padded, not always NUL terminated
+	uint32_t type;
+	uint16_t w, h;          // Sprite dimensions, 256x1 for palettes
+	uint32_t off;           // Offset of data from start of file
+	uint32_t len;           // Length of data in bytes
+};
+
+struct rcpak {
+	const uint8_t *base;    // Start of the mapping
+	size_t size;
+	const struct rcpak_entry *ents;
+	uint32_t count;
+};
+
+int rcpak_open(struct rcpak *pak, const char *path);
+void rcpak_close(struct rcpak *pak);
+const struct rcpak_entry *rcpak_find(const struct rcpak *pak, uint32_t type,
+                                     const char *name);
+const void *rcpak_data(const struct rcpak *pak, const struct rcpak_entry *e);
+const uint8_t *rcpak_sprite(const struct rcpak *pak, const char *name,
+                            int *w, int *h);
+const uint32_t *rcpak_palette(const struct rcpak *pak, const char *name);
+
+#endif
@@ -0,0 +1,150 @@
+/* RCRNG - Seedable random number streams for RCGL programs
+ *
+ * xoshiro256** and xoshiro128** are by David Blackman and Sebastiano Vigna,
+ * the bounded draw by Daniel Lemire. See rcgl.h for license (BSD 3-Clause).
+ */
+
+#include "rcrng.h"
+
+#define rotl64(x,k)     (((x) << (k)) | ((x) >> (64 - (k))))
+#define rotl32(x,k)     (((x) << (k)) | ((x) >> (32 - (k))))
+
+
+/* splitmix64 - Spread a seed out into well mixed state words */
+static uint64_t splitmix64(uint64_t *x)
+{
+	uint64_t z = (*x += 0x9E3779B97F4A7C15ull);
+
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+	return z ^ (z >> 31);
+}
+
+/* jump - Advance r by 2^128 draws */
+static void jump(struct rcrng *r)
+{
+	static const uint64_t poly[4] = {
+		0x180EC6D33CFD0ABAull, 0xD5A61266F0C9392Cull,
+		0xA9582618E03FC9AAull, 0x39ABDC4529B1661Cull
+	};
+	uint64_t t[4] = { 0, 0, 0, 0 };
+
+	for (int i = 0; i < 4; i++)
+		for (int b = 0; b < 64; b++) {
+			if (poly[i] & (uint64_t)1 << b)
+				for (int j = 0; j < 4; j++)
+					t[j] ^= r->s[j];
+			rcrng_next(r);
+		}
+	for (int j = 0; j < 4; j++)
+		r->s[j] = t[j];
+}
+
+/*
+ * rcrng_seed - Start stream number stream of seed
+ *
+ * Each stream costs a jump to reach, so number them from 0.
+ */
+void rcrng_seed(struct rcrng *r, uint64_t seed, unsigned stream)
+{
+	for (int i = 0; i < 4; i++)
+		r->s[i] = splitmix64(&seed);
+	while (stream--)
+		jump(r);
+}
+
+uint64_t rcrng_next(struct rcrng *r)
+{
+	uint64_t *s = r->s;
+	uint64_t out = rotl64(s[1] * 5, 7) * 9;
+	uint64_t t = s[1] << 17;
+
+	s[2] ^= s[0];
+	s[3] ^= s[1];
+	s[1] ^= s[2];
+	s[0] ^= s[3];
+	s[2] ^= t;
+	s[3] = rotl64(s[3], 45);
+	return out;
+}
+
+/* rcrng_below - A number from 0 to n-1, n must not be 0 */
+uint32_t rcrng_below(struct rcrng *r, uint32_t n)
+{
+	uint64_t m = (rcrng_next(r) >> 32) * n;
+
+	if ((uint32_t)m < n) {
+		uint32_t t = -n % n;
+		while ((uint32_t)m < t)
+			m = (rcrng_next(r) >> 32) * n;
+	}
+	return m >> 32;
+}
+
+/*
+ * rcrng8_seed - Seed the lanes of r from draws on stream from
+ *
+ * The lanes are seeded at random rather than jumped apart, with 2^128 draws
+ * in each lane's period they won't meet in practice.
+ */
+void rcrng8_seed(struct rcrng8 *r, struct rcrng *from)
+{
+	for (int l = 0; l < RCRNG_LANES; l++) {
+		uint64_t a = rcrng_next(from), b = rcrng_next(from);
+		r->s[0][l] = a;
+		r->s[1][l] = a >> 32;
+		r->s[2][l] = b;
+		r->s[3][l] = b >> 32 | 1;     // Never all zero
+	}
+}
+
+/* next8 - Step every lane, out[l] gets lane l's next number */
+static void next8(struct rcrng8 *restrict r, uint32_t *restrict out)
+{
+	uint32_t (*s)[RCRNG_LANES] = r->s;
+
+	for (int l = 0; l < RCRNG_LANES; l++) {
+		uint32_t t = s[1][l] << 9;
+
+		out[l] = rotl32(s[1][l] * 5, 7) * 9;
+		s[2][l] ^= s[0][l];
+		s[3][l] ^= s[1][l];
+		s[1][l] ^= s[2][l];
+		s[0][l] ^= s[3][l];
+		s[2][l] ^= t;
+		s[3][l] = rotl32(s[3][l], 11);
+	}
+}
+
+/*
+ * rcrng8_below - Fill out with RCRNG_LANES numbers from 0 to n-1
+ *
+ * All lanes draw together. The few draws that have to be rejected are
+ * drawn again with every lane stepping, only the rejected lanes being kept.
+ */
+void rcrng8_below(struct rcrng8 *r, uint32_t n, uint32_t *out)
+{
+	uint32_t x[RCRNG_LANES], lo[RCRNG_LANES], t;
+	uint32_t reject = 0;
+
+	next8(r, x);
+	for (int l = 0; l < RCRNG_LANES; l++) {
+		uint64_t m = (uint64_t)x[l] * n;
+		out[l] = m >> 32;
+		lo[l] = m;
+		reject |= lo[l] < n;
+	}
+	if (!reject)
+		return;
+
+	t = -n % n;
+	for (int l = 0; l < RCRNG_LANES; l++) {
+		while (lo[l] < t) {
+			uint64_t m;
+			next8(r, x);
+			m = (uint64_t)x[l] * n;
+			out[l] = m >> 32;
+			lo[l] = m;
+		}
+	}
+}
@@ -0,0 +1,44 @@
+/* RCRNG - Seedable random number streams for RCGL programs
+ *
+ * rand() takes a lock on every call, is a different generator on every libc
+ * and is usually reduced with a biased modulo. These streams are plain
+ * structs owned by whoever draws from them, so each subsystem or worker
+ * thread can have its own without sharing anything, and the same seed gives
+ * the same numbers everywhere.
+ *
+ * struct rcrng is xoshiro256**, for one number at a time. A stream is picked
+ * by a seed and a stream number, streams with the same seed and different
+ * numbers are 2^128 draws apart, so never overlap.
+ *
+ * struct rcrng8 is eight xoshiro128** lanes side by side for batches. Each
+ * lane steps with plain 32-bit arithmetic the compiler can turn into vector
+ * code, so filling eight numbers costs little more than one.
+ *
+ * Bounded numbers use Lemire's multiply and reject, which is unbiased and
+ * rarely needs a second draw.
+ *
+ * See rcgl.h for license (BSD 3-Clause).
+ */
+#ifndef RCRNG_H
+#define RCRNG_H
+
+#include <stdint.h>
+
+#define RCRNG_LANES     8
+
+struct rcrng {
+	uint64_t s[4];
+};
+
+struct rcrng8 {
+	uint32_t s[4][RCRNG_LANES];  // State word, then lane
+};
+
+void rcrng_seed(struct rcrng *r, uint64_t seed, unsigned stream);
+uint64_t rcrng_next(struct rcrng *r);
+uint32_t rcrng_below(struct rcrng *r, uint32_t n);
+
+void rcrng8_seed(struct rcrng8 *r, struct rcrng *from);
+void rcrng8_below(struct rcrng8 *r, uint32_t n, uint32_t *out);
+
+#endif
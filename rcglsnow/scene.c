@@ -0,0 +1,154 @@
+/* SCENE - What SNOW draws and how much snow falls on it
+ *
+ * See scene.h for the format, and rcgl.h for license (BSD 3-Clause).
+ */
+
+#include "scene.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#define MAXLINE     128
+#define COLFLAKES   10      // Flakes a spawn column can keep falling
+
+
+/*
+ * scene_default - The scene SNOW has always shown, for packs without one
+ */
+void scene_default(struct scene *sc)
+{
+	memset(sc, 0, sizeof(*sc));
+	strcpy(sc->palette, "vga");
+	sc->seed = 1;
+	sc->flakes = 200;
+	sc->minflakes = 200/4;
+	sc->maxflakes = 200*4;
+	sc->colour = 0xF;
+	sc->spawnx1 = SCENE_WID;
+	sc->nsprites = 2;
+	sc->sprites[0] = (struct scene_sprite){ "tree", 40, -2, 0 };
+	sc->sprites[1] = (struct scene_sprite){ "merry", 170, 120, 'm' };
+}
+
+/*
+ * narrow - Whether the spawn range is too narrow for the flakes
+ *
+ * A flake only spawns in a free spot along the top, so a few columns can't
+ * keep up with many flakes landing, and the snow falls thinner than asked.
+ */
+static int narrow(const struct scene *sc)
+{
+	return (sc->spawnx1 - sc->spawnx0) * COLFLAKES < sc->flakes;
+}
+
+/*
+ * setting - Apply one line, returns an error message or NULL
+ */
+static const char *setting(struct scene *sc, char *line)
+{
+	struct scene_sprite *sp;
+	char word[16], name[RCPAK_NAMELEN+1], key[2];
+	int n, a, b;
+
+	if ((n = sscanf(line, "%15s", word)) != 1)
+		return NULL;
+	if (word[0] == '#')
+		return NULL;
+	if (strcmp(word, "palette") == 0) {
+		if (sscanf(line, "%*s %16s", sc->palette) != 1)
+			return "palette needs a name";
+	} else if (strcmp(word, "seed") == 0) {
+		if (sscanf(line, "%*s %u", &sc->seed) != 1)
+			return "seed needs a number";
+	} else if (strcmp(word, "flakes") == 0) {
+		n = sscanf(line, "%*s %d %d %d", &sc->flakes, &a, &b);
+		if (n < 1 || sc->flakes < 1)
+			return "flakes needs a count";
+		if (n == 2
+		    || (n == 3 && (a < 1 || a > sc->flakes || b < sc->flakes)))
+			return "flakes needs min <= count <= max";
+		sc->minflakes = n == 3 ? a : (sc->flakes + 3) / 4;
+		sc->maxflakes = n == 3 ? b : sc->flakes * 4;
+		if (narrow(sc))
+			return "too many flakes for the spawn columns";
+	} else if (strcmp(word, "colour") == 0) {
+		if (sscanf(line, "%*s %i", &sc->colour) != 1
+		    || sc->colour < 1 || sc->colour > 255)
+			return "colour needs a palette index from 1 to 255";
+	} else if (strcmp(word, "spawn") == 0) {
+		if (sscanf(line, "%*s %d %d", &a, &b) != 2
+		    || a < 0 || b <= a || b > SCENE_WID)
+			return "spawn needs columns x0 < x1 within the screen";
+		sc->spawnx0 = a;
+		sc->spawnx1 = b;
+		if (narrow(sc))
+			return "spawn needs a column for every 10 flakes";
+	} else if (strcmp(word, "sprite") == 0) {
+		if (sc->nsprites == SCENE_MAXSPRITES)
+			return "too many sprites";
+		n = sscanf(line, "%*s %16s %d %d %1s", name, &a, &b, key);
+		if (n < 3)
+			return "sprite needs a name and position";
+		if (n == 4 && !isalpha((unsigned char)key[0]))
+			return "sprite key must be a letter";
+		sp = &sc->sprites[sc->nsprites++];
+		strcpy(sp->name, name);
+		sp->x = a;
+		sp->y = b;
+		sp->key = n == 4 ? tolower((unsigned char)key[0]) : 0;
+	} else {
+		return "unknown setting";
+	}
+	return NULL;
+}
+
+/*
+ * scene_parse - Read a scene from text, len bytes not NUL terminated
+ *
+ * Anything not set keeps its value from scene_default, except the sprites,
+ * a scene that lists any replaces them all. from names the text in errors.
+ * Returns 0 on success, -2 on a bad line.
+ */
+int scene_parse(struct scene *sc, const char *text, size_t len,
+                const char *from)
+{
+	struct scene_sprite sprites[SCENE_MAXSPRITES];
+	char line[MAXLINE];
+	const char *err, *end = text + len, *nl;
+	int lineno = 0, n;
+
+	scene_default(sc);
+	memcpy(sprites, sc->sprites, sizeof(sprites));
+	n = sc->nsprites;
+	sc->nsprites = 0;
+	for (; text < end; text = nl + 1) {
+		lineno++;
+		if ((nl = memchr(text, '\n', end - text)) == NULL)
+			nl = end;
+		if (nl - text >= MAXLINE) {
+			fprintf(stderr, "SCENE: %s line %d is too long\n", from, lineno);
+			return -2;
+		}
+		memcpy(line, text, nl - text);
+		line[nl - text] = '\0';
+		if ((err = setting(sc, line)) != NULL) {
+			fprintf(stderr, "SCENE: %s line %d, %s\n", from, lineno, err);
+			return -2;
+		}
+	}
+	if (sc->nsprites == 0) {
+		memcpy(sc->sprites, sprites, sizeof(sprites));
+		sc->nsprites = n;
+	}
+	return 0;
+}
+
+/*
+ * scene_place - Where a w x h sprite goes on a scrw x scrh screen
+ */
+void scene_place(const struct scene_sprite *sp, int w, int h, int scrw,
+                 int scrh, int *x, int *y)
+{
+	*x = sp->x >= 0 ? sp->x * scrw / SCENE_WID : scrw + sp->x + 1 - w;
+	*y = sp->y >= 0 ? sp->y * scrh / SCENE_HGT : scrh + sp->y + 1 - h;
+}
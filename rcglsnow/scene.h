@@ -0,0 +1,59 @@
+/* SCENE - What SNOW draws and how much snow falls on it
+ *
+ * A scene is a short text file, normally kept in the asset pack next to the
+ * sprites it names so that a new pack is a new scene, no rebuild. It is
+ * parsed once at startup into fixed arrays, there is nothing to allocate.
+ *
+ * One setting per line, # starts a comment:
+ *   palette name       Palette from the pack
+ *   seed n             Random seed, unless given on the command line
+ *   flakes n [min max] Flakes falling at once per 320x200 of screen, and
+ *                      the range SNOW -a may vary it over, a quarter to
+ *                      four times n by default
+ *   colour n           Palette index flakes and settled snow are drawn in
+ *   spawn x0 x1        Columns x0 to x1-1 of each screen flakes spawn in,
+ *                      at least one for every 10 flakes
+ *   sprite name x y [key]
+ *                      Sprite from the pack, stamped on every screen in
+ *                      the order listed. key is a letter that takes it down
+ *                      and puts it back up
+ *
+ * Positions are in the 320x200 layout of the original and scaled to the
+ * screen, except negative ones, which count back from the right or bottom
+ * edge unscaled, -1 putting a sprite's last column or row on the screen's.
+ *
+ * See rcgl.h for license (BSD 3-Clause).
+ */
+#ifndef SCENE_H
+#define SCENE_H
+
+#include "rcpak.h"
+#include <stddef.h>
+
+#define SCENE_MAXSPRITES    16
+#define SCENE_WID   320         // The layout positions are given in
+#define SCENE_HGT   200
+
+struct scene_sprite {
+	char name[RCPAK_NAMELEN+1];
+	int x, y;
+	char key;                   // 'a' to 'z', 0 for none
+};
+
+struct scene {
+	char palette[RCPAK_NAMELEN+1];
+	unsigned seed;
+	int flakes, minflakes, maxflakes;
+	int colour;
+	int spawnx0, spawnx1;
+	int nsprites;
+	struct scene_sprite sprites[SCENE_MAXSPRITES];
+};
+
+void scene_default(struct scene *sc);
+int scene_parse(struct scene *sc, const char *text, size_t len,
+                const char *from);
+void scene_place(const struct scene_sprite *sp, int w, int h, int scrw,
+                 int scrh, int *x, int *y);
+
+#endif
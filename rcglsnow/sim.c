@@ -0,0 +1,1572 @@
+/* SIM - Snowfall particle simulation
+ *
+ * Originally the main loop of SNOW, written for Turbo C 2.0 on a Turbo PC/XT
+ * clone drawing straight into Mode 13h VGA memory.
+ *
+ * As the snow reaches the top of the screen the density increases, as there
+ * are always budget flakes falling at once. A flake that finds no free
+ * column along the top to spawn in is made up on a later step, so a full
+ * screen or a narrow spawn range only thins the snow out. sim_thaw keeps
+ * the snow from reaching the top in the first place.
+ */
+#include "sim.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef unsigned int uint;
+
+/*
+ * A chunk of the world, SIM_CHUNK cells square. SIM_CHUNK is 64 so that a
+ * row of a chunk is one bitmap word. The cells are row by row, or brick by
+ * brick if built with smaller SIM_BRICKBITS, each brick row by row.
+ */
+struct sim_chunk {
+	uint8_t cell[SIM_CHUNK*SIM_CHUNK];  // Palette index, 0 is empty
+	uint64_t solid[SIM_CHUNK];  // Scenery and sleeping grains, bit x%64 of
+	                            // word y%64
+	uint64_t snow[SIM_CHUNK];   // Sleeping grains
+};
+
+#define CMASK           (SIM_CHUNK-1)
+#define chunkat(s,x,y)  (s)->chunks[((y)>>SIM_CHUNKBITS<<(s)->cwbits) \
+                                    + ((x)>>SIM_CHUNKBITS)]
+#define BRICK           (1 << SIM_BRICKBITS)
+#define BMASK           (BRICK-1)
+#define at(x,y)         ((((y)&CMASK) >> SIM_BRICKBITS                      \
+                          << (SIM_CHUNKBITS+SIM_BRICKBITS))                 \
+                         + (((x)&CMASK) >> SIM_BRICKBITS << 2*SIM_BRICKBITS) \
+                         + (((y)&BMASK) << SIM_BRICKBITS) + ((x)&BMASK))
+#define bit(x)          ((uint64_t)1 << ((x)&CMASK))
+
+#define THAWSWEEP       16      // Steps to look over the whole world
+#define THAWGAIN        32      // Steps to thaw away excess snow over
+#define PICKTRIES       16      // Random columns tried before searching
+
+/* Row drop d is at on the current frame */
+#define dropy(s,d)      ((s)->drops[d].y0 + (int)((s)->frame - (s)->drops[d].t0))
+
+
+/*
+ * sim_init - Allocate an empty wid x hgt world with room for nparticles
+ * flakes
+ *
+ * No chunks are allocated until something is drawn or comes to rest in
+ * them. Spawning and thawing draw from their own streams of seed, so that runs
+ * can be repeated and thawing doesn't change where flakes spawn.
+ */
+int sim_init(struct sim *s, int wid, int hgt, int nparticles, unsigned seed)
+{
+	struct rcrng rng;
+	int i;
+
+	memset(s, 0, sizeof(*s));
+	s->wid = wid;
+	s->hgt = hgt;
+	/* Rows of chunks a power of two apart, whatever the width */
+	while (1 << s->cwbits < (wid + CMASK) >> SIM_CHUNKBITS)
+		s->cwbits++;
+	s->cw = 1 << s->cwbits;
+	s->ch = (hgt + CMASK) >> SIM_CHUNKBITS;
+	for (s->landmask = 1; s->landmask <= (uint)hgt; s->landmask <<= 1)
+		;
+	s->flake = SIM_FLAKE;
+	s->spawnw = s->spawnperiod = s->spawnn = wid;
+	s->chunks = calloc(s->cw * s->ch, sizeof(*s->chunks));
+	s->x = calloc(nparticles, sizeof(*s->x));
+	s->y = calloc(nparticles, sizeof(*s->y));
+	s->drops = calloc(nparticles, sizeof(*s->drops));
+	s->top = calloc(wid, sizeof(*s->top));
+	s->column = calloc(wid, sizeof(*s->column));
+	s->landing = calloc(s->landmask, sizeof(*s->landing));
+	s->settled = calloc(nparticles, sizeof(*s->settled));
+	s->meltcap = nparticles + wid;
+	s->melted = calloc(s->meltcap, sizeof(*s->melted));
+	if (!s->chunks || !s->x || !s->y || !s->drops || !s->top || !s->column
+	    || !s->landing || !s->settled || !s->melted) {
+		sim_free(s);
+		return -1;
+	}
+	s->landmask--;
+	s->nparticles = s->budget = nparticles;
+	for (i = 0; i < nparticles; i++) {
+		s->drops[i].x = -1;
+		s->drops[i].next = i+1 < nparticles ? i+1 : -1;
+	}
+	for (i = 0; i < wid; i++) {
+		s->top[i] = hgt;
+		s->column[i] = -1;
+	}
+	for (i = 0; i <= (int)s->landmask; i++)
+		s->landing[i] = -1;
+	rcrng_seed(&rng, seed, 0);
+	rcrng8_seed(&s->spawnrng, &rng);
+	rcrng_seed(&s->thawrng, seed, 1);
+	return 0;
+}
+
+void sim_free(struct sim *s)
+{
+	if (s->chunks)
+		for (int i = 0; i < s->cw * s->ch; i++)
+			free(s->chunks[i]);
+	free(s->chunks);
+	free(s->x);
+	free(s->y);
+	free(s->drops);
+	free(s->top);
+	free(s->column);
+	free(s->landing);
+	free(s->ax);
+	free(s->ay);
+	free(s->settled);
+	free(s->woken);
+	free(s->melted);
+	memset(s, 0, sizeof(*s));
+}
+
+/*
+ * peek - The cell at (x, y), 0 in chunks never allocated
+ */
+static inline int peek(const struct sim *s, int x, int y)
+{
+	const struct sim_chunk *c = chunkat(s, x, y);
+
+	return c ? c->cell[at(x, y)] : 0;
+}
+
+static inline int solid(const struct sim *s, int x, int y)
+{
+	const struct sim_chunk *c = chunkat(s, x, y);
+
+	return c && (c->solid[y & CMASK] & bit(x));
+}
+
+/*
+ * need - The chunk holding (x, y), allocated if it isn't yet
+ *
+ * Returns NULL if it can't be, callers treat the cell as taken.
+ */
+static struct sim_chunk *need(struct sim *s, int x, int y)
+{
+	struct sim_chunk **c = &chunkat(s, x, y);
+
+	if (*c == NULL && (*c = calloc(1, sizeof(**c))) != NULL)
+		s->nchunks++;
+	return *c;
+}
+
+/*
+ * room - The cell at (x, y) to write to if it is empty, otherwise NULL
+ */
+static inline uint8_t *room(struct sim *s, int x, int y)
+{
+	struct sim_chunk *c = chunkat(s, x, y);
+
+	if (c == NULL && (c = need(s, x, y)) == NULL)
+		return NULL;
+	return c->cell[at(x, y)] == 0 ? &c->cell[at(x, y)] : NULL;
+}
+
+/*
+ * grow - Make room for twice as many awake grains
+ *
+ * settled[] and woken[] grow along with them, since every awake grain may
+ * fall asleep or have been woken in one step.
+ */
+static int grow(struct sim *s)
+{
+	int cap = s->awakecap ? s->awakecap*2 : 256;
+	void *p;
+
+	if ((p = realloc(s->ax, cap * sizeof(*s->ax))) == NULL)
+		return -1;
+	s->ax = p;
+	if ((p = realloc(s->ay, cap * sizeof(*s->ay))) == NULL)
+		return -1;
+	s->ay = p;
+	if ((p = realloc(s->woken, cap * sizeof(*s->woken))) == NULL)
+		return -1;
+	s->woken = p;
+	p = realloc(s->settled, (s->nparticles + cap) * sizeof(*s->settled));
+	if (p == NULL)
+		return -1;
+	s->settled = p;
+	s->awakecap = cap;
+	return 0;
+}
+
+/*
+ * queue - Add a grain to the end of the awake list
+ */
+static int queue(struct sim *s, int x, int y)
+{
+	if (s->nawake == s->awakecap && grow(s) < 0)
+		return -1;
+	s->ax[s->nawake] = x;
+	s->ay[s->nawake++] = y;
+	return 0;
+}
+
+/*
+ * live - Add a flake at (x, y) to the end of those being stepped
+ *
+ * Returns -1 if its chunk can't be allocated.
+ */
+static int live(struct sim *s, int x, int y)
+{
+	uint8_t *p = room(s, x, y);
+
+	if (p == NULL)
+		return -1;
+	*p = s->flake;
+	s->x[s->nlive] = x;
+	s->y[s->nlive++] = y;
+	return 0;
+}
+
+/*
+ * unlive - Stop stepping flake i, the rest close up in order
+ */
+static void unlive(struct sim *s, uint i)
+{
+	uint n = --s->nlive - i;
+
+	memmove(s->x + i, s->x + i+1, n * sizeof(*s->x));
+	memmove(s->y + i, s->y + i+1, n * sizeof(*s->y));
+}
+
+/*
+ * schedule - Queue drop d for the frame it reaches the top of its column
+ */
+static void schedule(struct sim *s, int d)
+{
+	struct sim_drop *p = &s->drops[d];
+	int *head;
+
+	p->land = p->t0 + (s->top[p->x]-1 - p->y0);
+	head = &s->landing[p->land & s->landmask];
+	p->prev = -1;
+	p->next = *head;
+	if (*head >= 0)
+		s->drops[*head].prev = d;
+	*head = d;
+}
+
+static void unschedule(struct sim *s, int d)
+{
+	struct sim_drop *p = &s->drops[d];
+
+	if (p->prev >= 0)
+		s->drops[p->prev].next = p->next;
+	else
+		s->landing[p->land & s->landmask] = p->next;
+	if (p->next >= 0)
+		s->drops[p->next].prev = p->prev;
+}
+
+/*
+ * drop - Let a flake at (x, y), above the top of its column, fall freely
+ *
+ * It has to be taken out of its cell already. There is always a free slot,
+ * as a flake is only dropped in place of one being stepped.
+ */
+static void drop(struct sim *s, int x, int y)
+{
+	int d = s->freedrop;
+	struct sim_drop *p = &s->drops[d];
+
+	s->freedrop = p->next;
+	p->x = x;
+	p->y0 = y;
+	p->t0 = s->frame;
+	p->cprev = -1;
+	p->cnext = s->column[x];
+	if (p->cnext >= 0)
+		s->drops[p->cnext].cprev = d;
+	s->column[x] = d;
+	schedule(s, d);
+}
+
+/*
+ * dropat - Whether a drop is at (x, y) on the current frame
+ */
+static int dropat(const struct sim *s, int x, int y)
+{
+	int d;
+
+	for (d = s->column[x]; d >= 0; d = s->drops[d].cnext)
+		if (dropy(s, d) == y)
+			return 1;
+	return 0;
+}
+
+/*
+ * spawni - A random column to spawn a flake in, as an index into every spawn
+ * range across the world
+ *
+ * Columns are drawn RCRNG_LANES at a time and handed out in turn.
+ */
+static int spawni(struct sim *s)
+{
+	if (s->nspawnx == 0) {
+		rcrng8_below(&s->spawnrng, s->spawnn, s->spawnx);
+		s->nspawnx = RCRNG_LANES;
+	}
+	return s->spawnx[RCRNG_LANES - s->nspawnx--];
+}
+
+/*
+ * rangex - The column spawn index i is
+ */
+static int rangex(const struct sim *s, int i)
+{
+	return i / s->spawnw * s->spawnperiod + s->spawnx0 + i % s->spawnw;
+}
+
+/*
+ * spawnx - A random column to spawn a flake in
+ */
+static int spawnx(struct sim *s)
+{
+	return rangex(s, spawni(s));
+}
+
+/*
+ * freex - A random column to spawn a flake in at row y, -1 if all are taken
+ *
+ * After a few random tries the columns are searched in order from a random
+ * one, so a crowded row costs a pass over it rather than hanging.
+ */
+static int freex(struct sim *s, int y)
+{
+	int i, j, cx;
+
+	for (i = 0; i < PICKTRIES; i++) {
+		cx = spawnx(s);
+		if (peek(s, cx, y) == 0 && !dropat(s, cx, y))
+			return cx;
+	}
+	j = spawni(s);
+	for (i = 0; i < s->spawnn; i++) {
+		cx = rangex(s, (i + j) % s->spawnn);
+		if (peek(s, cx, y) == 0 && !dropat(s, cx, y))
+			return cx;
+	}
+	return -1;
+}
+
+/*
+ * sim_spawnat - Spawn flakes only in columns x0 to x0+w-1 of every period
+ *
+ * The range repeats across the world as far as it fits. By default flakes
+ * spawn anywhere. Returns -1, changing nothing, if the range isn't in the
+ * world or overlaps the next.
+ */
+int sim_spawnat(struct sim *s, int x0, int w, int period)
+{
+	if (x0 < 0 || w < 1 || x0 + w > s->wid || w > period)
+		return -1;
+	s->spawnx0 = x0;
+	s->spawnw = w;
+	s->spawnperiod = period;
+	s->spawnn = ((s->wid - x0 - w) / period + 1) * w;
+	s->nspawnx = 0;
+	return 0;
+}
+
+/*
+ * spawntop - Put a new flake at a free spot along the top row
+ *
+ * One that isn't dropped is stood on something solid in the same chunk, so
+ * can't fail to be placed. Returns -1 if there is no free spot.
+ */
+static int spawntop(struct sim *s)
+{
+	int cx;
+
+	if ((cx = freex(s, 0)) < 0)
+		return -1;
+	if (s->top[cx] > 1)
+		drop(s, cx, 0);
+	else
+		live(s, cx, 0);
+	s->nspawned++;
+	return 0;
+}
+
+/*
+ * spawn - Replace a flake that has stopped, unless there are more in the air
+ * than the budget
+ *
+ * If the top row is full it is left to sim_step to make up later.
+ */
+static void spawn(struct sim *s)
+{
+	if (s->nfalling > s->budget || spawntop(s) < 0)
+		s->nfalling--;
+}
+
+/*
+ * land - Drop d has reached the top of its column, step it from here on
+ *
+ * Flakes being stepped don't see drops, so one may have moved into its way.
+ * It is stood on top instead, as it would have been stopped there.
+ */
+static void land(struct sim *s, int d)
+{
+	struct sim_drop *p = &s->drops[d];
+	int x = p->x, y = dropy(s, d);
+
+	unschedule(s, d);
+	if (p->cprev >= 0)
+		s->drops[p->cprev].cnext = p->cnext;
+	else
+		s->column[x] = p->cnext;
+	if (p->cnext >= 0)
+		s->drops[p->cnext].cprev = p->cprev;
+	p->x = -1;
+	p->next = s->freedrop;
+	s->freedrop = d;
+
+	while (y >= 0 && peek(s, x, y) != 0)
+		y--;
+	if (y < 0 || live(s, x, y) < 0)
+		spawn(s);
+}
+
+/*
+ * reland - The top of column x has moved, reschedule the drops in it
+ *
+ * Those already at or past the new top land now.
+ */
+static void reland(struct sim *s, int x)
+{
+	int d, next;
+
+	for (d = s->column[x]; d >= 0; d = next) {
+		next = s->drops[d].cnext;
+		if (dropy(s, d) >= s->top[x]-1) {
+			land(s, d);
+		} else {
+			unschedule(s, d);
+			schedule(s, d);
+		}
+	}
+}
+
+/*
+ * cover - Solid cell (x, y) has been set
+ */
+static void cover(struct sim *s, int x, int y)
+{
+	if (y < s->top[x]) {
+		s->top[x] = y;
+		reland(s, x);
+	}
+}
+
+/*
+ * uncover - Solid cell (x, y) has been cleared, find what is under it
+ */
+static void uncover(struct sim *s, int x, int y)
+{
+	if (y != s->top[x])
+		return;
+	while (++y < s->hgt && !solid(s, x, y))
+		if (chunkat(s, x, y) == NULL)
+			y |= CMASK;
+	s->top[x] = y < s->hgt ? y : s->hgt;
+	reland(s, x);
+}
+
+/*
+ * settle - Put a grain to sleep where it is
+ */
+static void settle(struct sim *s, int x, int y)
+{
+	struct sim_chunk *c = chunkat(s, x, y);
+
+	c->solid[y & CMASK] |= bit(x);
+	c->snow[y & CMASK] |= bit(x);
+	s->nsnow++;
+	s->settled[s->nsettled].x = x;
+	s->settled[s->nsettled++].y = y;
+	cover(s, x, y);
+}
+
+/*
+ * supported - Whether a stuck grain only rests on solid cells
+ *
+ * The cell below and both below it diagonally. One that is taken by a flake
+ * or awake grain may yet move out of the way.
+ */
+static int supported(const struct sim *s, int x, int y)
+{
+	const struct sim_chunk *c;
+
+	if (y == s->hgt-1)
+		return 1;
+	/* All three in one chunk, test them together */
+	if ((x & CMASK) != 0 && (x & CMASK) != CMASK && x != s->wid-1) {
+		c = chunkat(s, x, y+1);
+		return c && (c->solid[(y+1) & CMASK] >> ((x & CMASK)-1) & 7) == 7;
+	}
+	return solid(s, x, y+1) && (x == 0 || solid(s, x-1, y+1))
+	       && (x == s->wid-1 || solid(s, x+1, y+1));
+}
+
+/*
+ * wake - Wake the sleeping grains that could slide into (x, y), just cleared
+ *
+ * Those are the three above it, straight down or diagonally, which may be
+ * over the edge of a chunk. Woken grains are queued on the awake list and
+ * move from the next step. If the list can't grow they are left sleeping,
+ * nothing is lost.
+ */
+static void wake(struct sim *s, int x, int y)
+{
+	struct sim_chunk *c;
+	int gx, gy = y-1;
+
+	if (gy < 0)
+		return;
+	for (gx = x-1; gx <= x+1; gx++) {
+		if (gx < 0 || gx >= s->wid || (c = chunkat(s, gx, gy)) == NULL
+		    || !(c->snow[gy & CMASK] & bit(gx)))
+			continue;
+		if (queue(s, gx, gy) < 0)
+			return;
+		c->solid[gy & CMASK] &= ~bit(gx);
+		c->snow[gy & CMASK] &= ~bit(gx);
+		s->nsnow--;
+		s->woken[s->nwoken].x = gx;
+		s->woken[s->nwoken++].y = gy;
+		uncover(s, gx, gy);
+	}
+}
+
+/*
+ * sim_sprite - Draw an image into the scene for snow to fall on top of
+ *
+ * Snow under the image is lost, and any the image clears a way for will
+ * start to slide. Only the part inside the world is drawn. Returns -1 if a
+ * chunk it covers can't be allocated.
+ */
+int sim_sprite(struct sim *s, const uint8_t *spr, int x, int y, int w, int h)
+{
+	struct sim_chunk *c;
+	int i, j, cx, cy, v;
+
+	for (i = y < 0 ? -y : 0; i < h && y+i < s->hgt; i++) {
+		for (j = x < 0 ? -x : 0; j < w && x+j < s->wid; j++) {
+			cx = x+j;
+			cy = y+i;
+			v = spr[i*w + j];
+			if (v == 0 && (c = chunkat(s, cx, cy)) == NULL)
+				continue;
+			if ((c = need(s, cx, cy)) == NULL)
+				return -1;
+			c->cell[at(cx, cy)] = v;
+			if (c->snow[cy & CMASK] & bit(cx)) {
+				c->snow[cy & CMASK] &= ~bit(cx);
+				s->nsnow--;
+			}
+			if (v != 0) {
+				c->solid[cy & CMASK] |= bit(cx);
+				cover(s, cx, cy);
+			} else if (c->solid[cy & CMASK] & bit(cx)) {
+				c->solid[cy & CMASK] &= ~bit(cx);
+				uncover(s, cx, cy);
+				wake(s, cx, cy);
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * sim_erase - Clear part of the scene, scenery and settled snow alike
+ *
+ * Flakes and awake grains passing through are left be, snow resting on
+ * what was cleared will start to slide. The rectangle is clipped to the
+ * world.
+ */
+void sim_erase(struct sim *s, int x, int y, int w, int h)
+{
+	struct sim_chunk *c;
+	int i, j, cx, cy;
+
+	for (i = y < 0 ? -y : 0; i < h && y+i < s->hgt; i++) {
+		for (j = x < 0 ? -x : 0; j < w && x+j < s->wid; j++) {
+			cx = x+j;
+			cy = y+i;
+			if (!solid(s, cx, cy))
+				continue;
+			c = chunkat(s, cx, cy);
+			c->cell[at(cx, cy)] = 0;
+			c->solid[cy & CMASK] &= ~bit(cx);
+			if (c->snow[cy & CMASK] & bit(cx)) {
+				c->snow[cy & CMASK] &= ~bit(cx);
+				s->nsnow--;
+			}
+			uncover(s, cx, cy);
+			wake(s, cx, cy);
+		}
+	}
+}
+
+/*
+ * sim_maskinit - Pack the opaque pixels of a w x h sprite into a mask
+ *
+ * Done once per sprite, the mask can then be stamped into and cleared from
+ * the scene as often as needed. spr is kept for its colours, not copied.
+ * Returns -1 if out of memory.
+ */
+int sim_maskinit(struct sim_mask *m, const uint8_t *spr, int w, int h)
+{
+	int i, j;
+
+	m->spr = spr;
+	m->w = w;
+	m->h = h;
+	m->words = (w + 63) / 64;
+	if ((m->bits = calloc(h * m->words + 1, sizeof(*m->bits))) == NULL)
+		return -1;
+	for (i = 0; i < h; i++)
+		for (j = 0; j < w; j++)
+			if (spr[i*w + j] != 0)
+				m->bits[i*m->words + j/64] |= (uint64_t)1 << (j%64);
+	return 0;
+}
+
+void sim_maskfree(struct sim_mask *m)
+{
+	free(m->bits);
+	memset(m, 0, sizeof(*m));
+}
+
+/*
+ * maskbits - n <= 64 bits of row i of a mask, starting from pixel j
+ */
+static uint64_t maskbits(const struct sim_mask *m, int i, int j, int n)
+{
+	const uint64_t *row = m->bits + i*m->words + j/64;
+	uint64_t v = row[0] >> (j%64);
+
+	if (j%64 != 0 && j/64 + 1 < m->words)
+		v |= row[1] << (64 - j%64);
+	return n < 64 ? v & (((uint64_t)1 << n) - 1) : v;
+}
+
+/*
+ * maskword - The cells of the chunk row word holding (cx, cy) that a mask at
+ * (x, y) covers, from cx to the end of the word or the world
+ */
+static uint64_t maskword(const struct sim *s, const struct sim_mask *m, int x,
+                         int y, int cx, int cy)
+{
+	int n = SIM_CHUNK - (cx & CMASK);
+
+	if (n > s->wid - cx)
+		n = s->wid - cx;
+	return maskbits(m, cy - y, cx - x, n) << (cx & CMASK);
+}
+
+/*
+ * evict - Take whatever is moving through (x, y) out of the scene
+ *
+ * A flake is spawned again at the top, an awake grain is lost.
+ */
+static void evict(struct sim *s, int x, int y)
+{
+	int i;
+
+	for (i = 0; i < s->nlive; i++) {
+		if (s->x[i] == x && s->y[i] == y) {
+			unlive(s, i);
+			spawn(s);
+			return;
+		}
+	}
+	for (i = 0; i < s->nawake; i++) {
+		if (s->ax[i] == x && s->ay[i] == y) {
+			s->nawake--;
+			memmove(s->ax + i, s->ax + i+1, (s->nawake - i)*sizeof(*s->ax));
+			memmove(s->ay + i, s->ay + i+1, (s->nawake - i)*sizeof(*s->ay));
+			return;
+		}
+	}
+}
+
+/*
+ * sim_stamp - Place an obstacle with mask m at (x, y)
+ *
+ * Only its opaque pixels are drawn, so obstacles can be layered over each
+ * other and the scenery. The bitmaps are updated a word at a time, snow it
+ * covers is lost, flakes caught inside spawn again and falling flakes in its
+ * columns are sent to land on it. Returns -1 if a chunk it covers can't be
+ * allocated.
+ */
+int sim_stamp(struct sim *s, const struct sim_mask *m, int x, int y)
+{
+	struct sim_chunk *c;
+	uint64_t bits, fresh;
+	int cx, cy, r, b, gx;
+
+	for (cy = y < 0 ? 0 : y; cy < y + m->h && cy < s->hgt; cy++) {
+		r = cy & CMASK;
+		for (cx = x < 0 ? 0 : x; cx < x + m->w && cx < s->wid;
+		     cx = (cx | CMASK) + 1) {
+			if ((bits = maskword(s, m, x, y, cx, cy)) == 0)
+				continue;
+			if ((c = need(s, cx, cy)) == NULL)
+				return -1;
+			fresh = bits & ~c->solid[r];
+			s->nsnow -= __builtin_popcountll(bits & c->snow[r]);
+			c->snow[r] &= ~bits;
+			c->solid[r] |= bits;
+			for (; bits; bits &= bits-1) {
+				b = __builtin_ctzll(bits);
+				gx = (cx & ~CMASK) + b;
+				if ((fresh >> b & 1) && c->cell[at(gx, cy)] != 0)
+					evict(s, gx, cy);
+				c->cell[at(gx, cy)] = m->spr[(cy-y)*m->w + gx-x];
+				if (fresh >> b & 1)
+					cover(s, gx, cy);
+			}
+		}
+	}
+	return 0;
+}
+
+/*
+ * sim_unstamp - Take the obstacle with mask m at (x, y) away
+ *
+ * Clears the cells under its opaque pixels, anything else stamped there as
+ * well, and wakes the snow resting on it. Snow only needs waking where
+ * there is some in the row above, found a word at a time.
+ */
+void sim_unstamp(struct sim *s, const struct sim_mask *m, int x, int y)
+{
+	struct sim_chunk *c, *up;
+	uint64_t bits, above;
+	int cx, cy, r, b, gx;
+
+	for (cy = y < 0 ? 0 : y; cy < y + m->h && cy < s->hgt; cy++) {
+		r = cy & CMASK;
+		for (cx = x < 0 ? 0 : x; cx < x + m->w && cx < s->wid;
+		     cx = (cx | CMASK) + 1) {
+			if ((c = chunkat(s, cx, cy)) == NULL)
+				continue;
+			bits = maskword(s, m, x, y, cx, cy) & c->solid[r] & ~c->snow[r];
+			if (bits == 0)
+				continue;
+			c->solid[r] &= ~bits;
+			if (r > 0)
+				above = c->snow[r-1];
+			else if (cy > 0 && (up = chunkat(s, cx, cy-1)) != NULL)
+				above = up->snow[CMASK];
+			else
+				above = 0;
+			/* Grains at either end may be over the edge of the chunk */
+			above |= above << 1 | above >> 1 | 1 | (uint64_t)1 << CMASK;
+			for (; bits; bits &= bits-1) {
+				b = __builtin_ctzll(bits);
+				gx = (cx & ~CMASK) + b;
+				c->cell[at(gx, cy)] = 0;
+				uncover(s, gx, cy);
+				if (above >> b & 1)
+					wake(s, gx, cy);
+			}
+		}
+	}
+}
+
+/*
+ * sim_spawn - Scatter the initial flakes, one per row from the top down
+ *
+ * Rows with no room are skipped, sim_step makes those flakes up along the
+ * top. Returns -1 if a chunk for one can't be allocated.
+ */
+int sim_spawn(struct sim *s)
+{
+	uint i;
+	int cx, cy;
+
+	for (i = 0; i < (uint)s->budget; i++) {
+		cy = i * s->hgt / s->budget;
+		if ((cx = freex(s, cy)) < 0)
+			continue;
+		if (cy < s->top[cx]-1)
+			drop(s, cx, cy);
+		else if (live(s, cx, cy) < 0)
+			return -1;
+		s->nfalling++;
+	}
+	return 0;
+}
+
+/*
+ * makeroom - Make room for n flakes in the air, n more than there is
+ *
+ * The new drops go on the free list. Returns -1 if out of memory, with
+ * nothing changed but the arrays that could be grown.
+ */
+static int makeroom(struct sim *s, int n)
+{
+	void *p;
+	int i;
+
+	if ((p = realloc(s->x, n * sizeof(*s->x))) == NULL)
+		return -1;
+	s->x = p;
+	if ((p = realloc(s->y, n * sizeof(*s->y))) == NULL)
+		return -1;
+	s->y = p;
+	if ((p = realloc(s->drops, n * sizeof(*s->drops))) == NULL)
+		return -1;
+	s->drops = p;
+	if ((p = realloc(s->settled, (n + s->awakecap) * sizeof(*s->settled)))
+	    == NULL)
+		return -1;
+	s->settled = p;
+	for (i = s->nparticles; i < n; i++) {
+		s->drops[i].x = -1;
+		s->drops[i].next = i+1 < n ? i+1 : s->freedrop;
+	}
+	s->freedrop = s->nparticles;
+	s->nparticles = n;
+	return 0;
+}
+
+/*
+ * sim_budget - Keep n flakes in the air from now on, after sim_spawn
+ *
+ * Flakes added are dropped straight away, spread from the top of the sky
+ * down to whatever is under them so they don't all arrive at once. If the
+ * sky is too crowded to find room for them, the rest are made up along the
+ * top by sim_step. Flakes over the budget drop out as they come to rest
+ * instead of being replaced, so the snow thins out over the time it takes
+ * to fall. Returns -1 if out of memory, with the budget unchanged.
+ */
+int sim_budget(struct sim *s, int n)
+{
+	int i, j, add, cx, cy;
+
+	if (n < 0 || (n > s->nparticles && makeroom(s, n) < 0))
+		return -1;
+	s->budget = n;
+	add = n - s->nfalling;
+	for (i = 0; i < add; i++) {
+		for (j = 0; j < PICKTRIES; j++) {
+			cx = spawnx(s);
+			cy = i * (s->top[cx]-1) / add;
+			if (cy < s->top[cx]-1 && !dropat(s, cx, cy))
+				break;
+		}
+		if (j == PICKTRIES)
+			break;
+		drop(s, cx, cy);
+		s->nfalling++;
+	}
+	return 0;
+}
+
+/*
+ * fall - Move a flake or grain at (*cx, *cy) down a pixel if it can
+ *
+ * Straight down if there is room, otherwise it tries to spread out, down and
+ * left and then down and right. Returns 0 if it is stuck.
+ */
+static inline int fall(struct sim *s, int *cx, int *cy)
+{
+	struct sim_chunk *c;
+	int x = *cx, y = *cy, nx;
+	uint8_t *p;
+
+	if (y == s->hgt-1)
+		return 0;
+	/* All three cells below in one row of a brick, the usual case */
+	c = chunkat(s, x, y+1);
+	if (c && (x & BMASK) != 0 && (x & BMASK) != BMASK && x != s->wid-1) {
+		p = &c->cell[at(x, y+1)];
+		if (p[0] == 0)
+			nx = x;
+		else if (p[-1] == 0)
+			p--, nx = x-1;
+		else if (p[1] == 0)
+			p++, nx = x+1;
+		else
+			return 0;
+	} else if ((p = room(s, x, y+1)) != NULL)
+		nx = x;
+	else if (x != 0 && (p = room(s, x-1, y+1)) != NULL)
+		nx = x-1;
+	else if (x != s->wid-1 && (p = room(s, x+1, y+1)) != NULL)
+		nx = x+1;
+	else
+		return 0;
+	chunkat(s, x, y)->cell[at(x, y)] = 0;
+	*p = s->flake;
+	*cx = nx;
+	*cy = y+1;
+	return 1;
+}
+
+/*
+ * melt - Thaw the sleeping grain at (x, y) in chunk c
+ */
+static void melt(struct sim *s, struct sim_chunk *c, int x, int y)
+{
+	c->cell[at(x, y)] = 0;
+	c->solid[y & CMASK] &= ~bit(x);
+	c->snow[y & CMASK] &= ~bit(x);
+	s->nsnow--;
+	s->melted[s->nmelted].x = x;
+	s->melted[s->nmelted++].y = y;
+	uncover(s, x, y);
+	wake(s, x, y);
+}
+
+/*
+ * thaw - Melt up to budget exposed grains
+ *
+ * Looks at the next 1/THAWSWEEP of the bitmap words, carrying on from where
+ * the last step left off. A grain is exposed if none of the three cells above
+ * it are solid, so melting it wakes nothing and the pile sinks instead of
+ * sliding. About half the exposed grains in a word are taken.
+ */
+static void thaw(struct sim *s, int budget)
+{
+	uint total = s->cw * s->ch * SIM_CHUNK;
+	uint words = (total + THAWSWEEP-1) / THAWSWEEP;
+	uint k = s->thawword, n, ci;
+	struct sim_chunk *c, *up;
+	uint64_t above, bits;
+	int r, b;
+
+	for (n = 0; n < words && budget > 0; n++, k++) {
+		if (k >= total)
+			k = 0;
+		ci = k >> SIM_CHUNKBITS;
+		r = k & CMASK;
+		if ((c = s->chunks[ci]) == NULL) {
+			k |= CMASK;
+			continue;
+		}
+		if (c->snow[r] == 0)
+			continue;
+		if (r > 0)
+			above = c->solid[r-1];
+		else if (ci >= (uint)s->cw && (up = s->chunks[ci - s->cw]) != NULL)
+			above = up->solid[CMASK];
+		else
+			above = 0;
+		above |= above << 1 | above >> 1;
+		bits = c->snow[r] & ~above & rcrng_next(&s->thawrng);
+		for (; bits && budget > 0; bits &= bits-1, budget--) {
+			b = __builtin_ctzll(bits);
+			melt(s, c, (ci % s->cw) * SIM_CHUNK + b,
+			     (ci / s->cw) * SIM_CHUNK + r);
+		}
+	}
+	s->thawword = k;
+}
+
+/*
+ * sim_thaw - Hold settled snow at fill percent of the world, 0 to let it
+ * pile up
+ */
+void sim_thaw(struct sim *s, int fill)
+{
+	s->thaw = (long)s->wid * s->hgt * fill / 100;
+	if (fill > 0 && s->thaw == 0)
+		s->thaw = 1;
+}
+
+/*
+ * sim_step - Move every flake and awake grain one pixel
+ *
+ * Flakes being stepped are moved in order, each seeing the ones before it
+ * already moved. One that halts, or comes off a pile into open air above
+ * its column, is taken out and the rest close up, and any flake that takes
+ * its place waits until the next step. Then drops reaching the top of their
+ * column land, and awake grains follow, grains woken along the way start
+ * moving on the next step. If there is more snow than sim_thaw allows, some
+ * of it thaws. Last, flakes there was no room to spawn are made up, as far
+ * as there is room now.
+ */
+void sim_step(struct sim *s)
+{
+	int *x = s->x, *y = s->y;
+	uint n = s->nlive;
+	uint i = 0;
+	int cx, cy, awake, d, next, j, k;
+
+	s->frame++;
+	s->nspawned = 0;
+	s->nsettled = 0;
+	s->nwoken = 0;
+	s->nmelted = 0;
+	awake = s->nawake;
+
+	while (i < n) {
+		cx = x[i];
+		cy = y[i];
+
+		if (fall(s, &cx, &cy)) {
+			if (cy >= s->top[cx]-1) {
+				x[i] = cx;
+				y[i++] = cy;
+				continue;
+			}
+			unlive(s, i);
+			n--;
+			chunkat(s, cx, cy)->cell[at(cx, cy)] = 0;
+			drop(s, cx, cy);
+		} else {
+			/*
+			 * Halt particle, it sleeps unless it is held up by
+			 * something that may still move, and replace it
+			 */
+			unlive(s, i);
+			n--;
+			if (supported(s, cx, cy) || queue(s, cx, cy) < 0)
+				settle(s, cx, cy);
+			spawn(s);
+		}
+	}
+
+	for (d = s->landing[s->frame & s->landmask]; d >= 0; d = next) {
+		next = s->drops[d].next;
+		land(s, d);
+	}
+
+	/* Grains that fall asleep drop out, the rest close up in order */
+	for (j = k = 0; k < awake; k++) {
+		cx = s->ax[k];
+		cy = s->ay[k];
+		if (fall(s, &cx, &cy)) {
+			wake(s, s->ax[k], s->ay[k]);
+		} else if (supported(s, cx, cy)) {
+			settle(s, cx, cy);
+			continue;
+		}
+		s->ax[j] = cx;
+		s->ay[j++] = cy;
+	}
+	/* Followed by those just woken */
+	if (j != awake) {
+		memmove(s->ax + j, s->ax + awake, (s->nawake - awake)*sizeof(*s->ax));
+		memmove(s->ay + j, s->ay + awake, (s->nawake - awake)*sizeof(*s->ay));
+		s->nawake -= awake - j;
+	}
+
+	/* Thaw what settled, and a share of any excess */
+	if (s->thaw && s->nsnow > s->thaw) {
+		k = s->nsettled + (s->nsnow - s->thaw) / THAWGAIN;
+		thaw(s, k < s->meltcap ? k : s->meltcap);
+	}
+
+	while (s->nfalling < s->budget && spawntop(s) == 0)
+		s->nfalling++;
+}
+
+/*
+ * sim_forward - Take steps steps as fast as they will go
+ *
+ * For catching up after a pause or baking a scene ahead of time, nothing is
+ * drawn on the way. settled[], woken[] and melted[] only tell of the last
+ * step, so a display has to redraw its static layer with sim_drawstill once
+ * it is done. Returns the steps taken per second.
+ */
+double sim_forward(struct sim *s, long steps)
+{
+	struct timespec t0, t1;
+	double secs;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (long i = 0; i < steps; i++)
+		sim_step(s);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	return secs > 0 ? steps / secs : 0;
+}
+
+/*
+ * view - Copy the w x h view at (x, y) from the chunks it covers
+ *
+ * Chunks never allocated read as empty, so does anything outside the world.
+ * Only solid cells are copied if still is set. Bricks are put back in rows
+ * on the way, a row of one at a time.
+ */
+static void view(const struct sim *s, uint8_t *dst, int x, int y, int w, int h,
+                 int still)
+{
+	const struct sim_chunk *c;
+	int i, j, k, cx, cy, n;
+
+	memset(dst, 0, w*h);
+	for (i = 0; i < h; i++) {
+		cy = y+i;
+		if (cy < 0 || cy >= s->hgt)
+			continue;
+		for (cx = x < 0 ? 0 : x; cx < x+w && cx < s->wid; cx += n) {
+			n = SIM_CHUNK - (cx & CMASK);
+			if (n > x+w - cx)
+				n = x+w - cx;
+			if ((c = chunkat(s, cx, cy)) == NULL)
+				continue;
+			if (!still) {
+				for (j = 0; j < n; j += k) {
+					k = BRICK - ((cx+j) & BMASK);
+					if (k > n - j)
+						k = n - j;
+					memcpy(dst + i*w + cx-x+j, &c->cell[at(cx+j, cy)], k);
+				}
+				continue;
+			}
+			for (j = 0; j < n; j++)
+				if (c->solid[cy & CMASK] & bit(cx+j))
+					dst[i*w + cx-x+j] = c->cell[at(cx+j, cy)];
+		}
+	}
+}
+
+/*
+ * sim_draw - Copy the w x h view at (x, y) to dst, with everything in it
+ */
+void sim_draw(const struct sim *s, uint8_t *dst, int x, int y, int w, int h)
+{
+	int d, dy;
+
+	view(s, dst, x, y, w, h, 0);
+	for (d = 0; d < s->nparticles; d++) {
+		if (s->drops[d].x < x || s->drops[d].x >= x+w)
+			continue;
+		dy = dropy(s, d) - y;
+		if (dy >= 0 && dy < h)
+			dst[dy*w + s->drops[d].x-x] = s->flake;
+	}
+}
+
+/*
+ * sim_drawstill - Copy only the scenery and sleeping snow in the view to dst
+ *
+ * What a display keeps in its static layer, everything moving is left out.
+ */
+void sim_drawstill(const struct sim *s, uint8_t *dst, int x, int y, int w,
+                   int h)
+{
+	view(s, dst, x, y, w, h, 1);
+}
+
+
+/* SNAPSHOTS */
+
+#define SNAPMAGIC   "SNOW"
+#define SNAPVERSION 6
+#define SNAPALIGN   8
+
+/*
+ * Written as the structs are in memory, so a snapshot is only good on the
+ * same kind of machine, and followed by each array in turn, see sim_save.
+ */
+struct snaphdr {
+	char magic[4];
+	uint32_t version;
+	uint64_t size;              // Bytes in the whole file
+	uint32_t chunksize;         // sizeof(struct sim_chunk)
+	uint32_t brickbits;         // SIM_BRICKBITS, the order of the cells
+	int32_t wid, hgt, nparticles;
+	int32_t nchunks, nlive, freedrop, nawake, nsnow, thaw, nspawnx;
+	uint32_t landmask, thawword, frame;
+	int32_t flake, spawnx0, spawnw, spawnperiod;
+	int32_t nfalling, budget;
+	uint32_t user;
+	struct rcrng thawrng;
+	struct rcrng8 spawnrng;
+	uint32_t spawnx[RCRNG_LANES];
+};
+
+/* An array in the file, its size and where it is in struct sim */
+struct snapsec {
+	size_t len;
+	void *p;
+};
+
+/*
+ * sections - List the arrays after the header in s, sized as in hdr
+ *
+ * The chunk index, one uint32_t per allocated chunk, comes first, then the
+ * chunks in the same order. sec[1] only gets a size, they aren't contiguous.
+ */
+#define NSECS   10
+static void sections(struct sim *s, const struct snaphdr *hdr,
+                     uint32_t *index, struct snapsec *sec)
+{
+	sec[0] = (struct snapsec){ hdr->nchunks * sizeof(uint32_t), index };
+	sec[1] = (struct snapsec){ hdr->nchunks * sizeof(struct sim_chunk), NULL };
+	sec[2] = (struct snapsec){ hdr->nlive * sizeof(*s->x), s->x };
+	sec[3] = (struct snapsec){ hdr->nlive * sizeof(*s->y), s->y };
+	sec[4] = (struct snapsec){ hdr->nparticles * sizeof(*s->drops), s->drops };
+	sec[5] = (struct snapsec){ hdr->wid * sizeof(*s->top), s->top };
+	sec[6] = (struct snapsec){ hdr->wid * sizeof(*s->column), s->column };
+	sec[7] = (struct snapsec){ (hdr->landmask+1) * sizeof(*s->landing),
+	                           s->landing };
+	sec[8] = (struct snapsec){ hdr->nawake * sizeof(*s->ax), s->ax };
+	sec[9] = (struct snapsec){ hdr->nawake * sizeof(*s->ay), s->ay };
+}
+
+static size_t align(size_t n)
+{
+	return (n + SNAPALIGN-1) & ~(size_t)(SNAPALIGN-1);
+}
+
+/*
+ * sim_save - Write everything needed to carry on stepping s to a file
+ *
+ * A header with the counts, sizes and random state, then the chunk index,
+ * the chunks, the stepped flakes, the drops, top[], column[], landing[] and
+ * the awake grains, each starting on a SNAPALIGN byte boundary. What the
+ * last step settled, woke and melted isn't kept, redraw the static layer
+ * with sim_drawstill after loading.
+ *
+ * The file is written beside path and renamed over it once complete, so a
+ * crash part way through leaves the last snapshot as it was.
+ * Returns 0 on success, negative on failure.
+ */
+int sim_save(struct sim *s, const char *path)
+{
+	static const uint8_t pad[SNAPALIGN];
+	struct snaphdr hdr;
+	struct snapsec sec[NSECS];
+	uint32_t *index;
+	size_t size;
+	char *tmp;
+	FILE *fp = NULL;
+	int i, n, rval = -1;
+
+	index = malloc(s->nchunks * sizeof(*index) + 1);
+	tmp = malloc(strlen(path) + 5);
+	if (index == NULL || tmp == NULL)
+		goto fail;
+	for (i = n = 0; i < s->cw * s->ch; i++)
+		if (s->chunks[i])
+			index[n++] = i;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, SNAPMAGIC, 4);
+	hdr.version = SNAPVERSION;
+	hdr.chunksize = sizeof(struct sim_chunk);
+	hdr.brickbits = SIM_BRICKBITS;
+	hdr.wid = s->wid;
+	hdr.hgt = s->hgt;
+	hdr.nparticles = s->nparticles;
+	hdr.nchunks = n;
+	hdr.nlive = s->nlive;
+	hdr.freedrop = s->freedrop;
+	hdr.nawake = s->nawake;
+	hdr.nsnow = s->nsnow;
+	hdr.thaw = s->thaw;
+	hdr.nspawnx = s->nspawnx;
+	hdr.flake = s->flake;
+	hdr.spawnx0 = s->spawnx0;
+	hdr.spawnw = s->spawnw;
+	hdr.spawnperiod = s->spawnperiod;
+	hdr.nfalling = s->nfalling;
+	hdr.budget = s->budget;
+	hdr.user = s->user;
+	hdr.landmask = s->landmask;
+	hdr.thawword = s->thawword;
+	hdr.frame = s->frame;
+	hdr.thawrng = s->thawrng;
+	hdr.spawnrng = s->spawnrng;
+	memcpy(hdr.spawnx, s->spawnx, sizeof(hdr.spawnx));
+	sections(s, &hdr, index, sec);
+	size = align(sizeof(hdr));
+	for (i = 0; i < NSECS; i++)
+		size += align(sec[i].len);
+	hdr.size = size;
+
+	sprintf(tmp, "%s.new", path);
+	if ((fp = fopen(tmp, "wb")) == NULL) {
+		fprintf(stderr, "SIM: Failed to create %s\n", tmp);
+		goto fail;
+	}
+	fwrite(&hdr, 1, sizeof(hdr), fp);
+	fwrite(pad, 1, align(sizeof(hdr)) - sizeof(hdr), fp);
+	for (i = 0; i < NSECS; i++) {
+		if (i == 1) {
+			for (int j = 0; j < n; j++)
+				fwrite(s->chunks[index[j]], 1, sizeof(struct sim_chunk), fp);
+		} else if (sec[i].len) {
+			fwrite(sec[i].p, 1, sec[i].len, fp);
+		}
+		fwrite(pad, 1, align(sec[i].len) - sec[i].len, fp);
+	}
+	if (fflush(fp) != 0 || ferror(fp) || fsync(fileno(fp)) < 0) {
+		fprintf(stderr, "SIM: Failed to write %s\n", tmp);
+		goto fail;
+	}
+	fclose(fp);
+	fp = NULL;
+	if (rename(tmp, path) < 0) {
+		fprintf(stderr, "SIM: Failed to replace %s\n", path);
+		goto fail;
+	}
+	rval = 0;
+
+fail:
+	if (fp) {
+		fclose(fp);
+		remove(tmp);
+	}
+	free(tmp);
+	free(index);
+	return rval;
+}
+
+static int isdrop(const struct sim *s, int d)
+{
+	return d >= 0 && d < s->nparticles;
+}
+
+static int inworld(const struct sim *s, int x, int y)
+{
+	return x >= 0 && x < s->wid && y >= 0 && y < s->hgt;
+}
+
+/*
+ * drawn - Whether (x, y) is in the world and something is drawn there, as
+ * it is under every flake being stepped and every awake grain
+ */
+static int drawn(const struct sim *s, int x, int y)
+{
+	const struct sim_chunk *c;
+
+	return inworld(s, x, y) && (c = chunkat(s, x, y)) != NULL
+	       && c->cell[at(x, y)] != 0;
+}
+
+/*
+ * sane - Whether everything loaded into s is in range and hangs together
+ *
+ * Flakes being stepped and awake grains have to be drawn in their cells,
+ * which are in chunks that have been allocated. Every drop in use has to be
+ * above the top of its column, scheduled for when it gets there, and in its
+ * column's list and that frame's list once each, and every other drop in the
+ * free list, as many as there are flakes to fall. Lists are walked no further
+ * than there are drops, so a loop in one fails rather than hangs. Nothing may
+ * be solid outside the world, or the thaw would go looking for it, and the
+ * columns left to spawn in have to be in the spawn ranges.
+ */
+static int sane(const struct sim *s)
+{
+	const struct sim_chunk *c;
+	const struct sim_drop *p;
+	int cols = (s->wid + CMASK) >> SIM_CHUNKBITS;
+	uint64_t edge = s->wid & CMASK ? ~(uint64_t)0 << (s->wid & CMASK) : 0;
+	uint64_t any;
+	int i, d, r, prev, n, used = 0;
+
+	for (i = 0; i < s->nlive; i++)
+		if (!drawn(s, s->x[i], s->y[i]))
+			return 0;
+	for (i = 0; i < s->nawake; i++)
+		if (!drawn(s, s->ax[i], s->ay[i]))
+			return 0;
+	for (i = 0; i < s->wid; i++)
+		if (s->top[i] < 0 || s->top[i] > s->hgt)
+			return 0;
+	for (d = 0; d < s->nparticles; d++) {
+		p = &s->drops[d];
+		if (p->x == -1)
+			continue;
+		if (p->x < 0 || p->x >= s->wid
+		    || dropy(s, d) < 0 || dropy(s, d) >= s->top[p->x]-1
+		    || p->land != p->t0 + (s->top[p->x]-1 - p->y0))
+			return 0;
+		used++;
+	}
+	if (s->nlive + used != s->nfalling)
+		return 0;
+
+	for (i = 0, n = 0; i < s->wid; i++)
+		for (prev = -1, d = s->column[i]; d != -1; prev = d,
+		     d = s->drops[d].cnext)
+			if (!isdrop(s, d) || s->drops[d].x != i
+			    || s->drops[d].cprev != prev || ++n > used)
+				return 0;
+	if (n != used)
+		return 0;
+	for (i = 0, n = 0; i <= (int)s->landmask; i++)
+		for (prev = -1, d = s->landing[i]; d != -1; prev = d,
+		     d = s->drops[d].next)
+			if (!isdrop(s, d) || s->drops[d].x < 0
+			    || s->drops[d].prev != prev
+			    || (s->drops[d].land & s->landmask) != (uint)i
+			    || ++n > used)
+				return 0;
+	if (n != used)
+		return 0;
+	for (n = 0, d = s->freedrop; d != -1; d = s->drops[d].next)
+		if (!isdrop(s, d) || s->drops[d].x != -1
+		    || ++n > s->nparticles - used)
+			return 0;
+	if (n != s->nparticles - used)
+		return 0;
+
+	for (i = 0; i < s->cw * s->ch; i++) {
+		if ((c = s->chunks[i]) == NULL)
+			continue;
+		if (i % s->cw >= cols)
+			return 0;
+		for (r = 0; r < SIM_CHUNK; r++) {
+			any = c->solid[r] | c->snow[r];
+			if ((i / s->cw * SIM_CHUNK + r >= s->hgt && any)
+			    || (i % s->cw == cols-1 && (any & edge)))
+				return 0;
+		}
+	}
+	for (i = RCRNG_LANES - s->nspawnx; i < RCRNG_LANES; i++)
+		if (s->spawnx[i] >= (uint32_t)s->spawnn)
+			return 0;
+	return 1;
+}
+
+/*
+ * sim_load - Set up s from a snapshot written by sim_save
+ *
+ * The file is mapped and copied straight into a freshly allocated sim, chunk
+ * by chunk, since each chunk is allocated on its own as snow first reaches
+ * it and kept until sim_free. Carries on from the frame it was saved at,
+ * spawn and thaw included.
+ * Everything in it is checked before it is used, see sane. Returns 0 on
+ * success, -1 if the file can't be read or memory allocated, -2 if it isn't
+ * a snapshot this build can load or is corrupt. On failure s is left empty.
+ */
+int sim_load(struct sim *s, const char *path)
+{
+	const struct snaphdr *hdr;
+	struct snapsec sec[NSECS];
+	const uint8_t *p;
+	const uint32_t *index;
+	struct stat st;
+	void *map;
+	size_t size;
+	int fd, i, rval = -2;
+
+	memset(s, 0, sizeof(*s));
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "SIM: Failed to open %s\n", path);
+		return -1;
+	}
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(*hdr)) {
+		fprintf(stderr, "SIM: %s is not a snapshot\n", path);
+		close(fd);
+		return -2;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);  // Mapping holds its own reference
+	if (map == MAP_FAILED) {
+		fprintf(stderr, "SIM: Failed to map %s\n", path);
+		return -1;
+	}
+
+	hdr = map;
+	if (memcmp(hdr->magic, SNAPMAGIC, 4) != 0
+	    || hdr->version != SNAPVERSION
+	    || hdr->chunksize != sizeof(struct sim_chunk)
+	    || hdr->brickbits != SIM_BRICKBITS
+	    || hdr->size != (uint64_t)st.st_size
+	    || hdr->wid <= 0 || hdr->hgt <= 0 || hdr->nparticles < 0
+	    || hdr->wid > INT32_MAX / hdr->hgt) {
+		fprintf(stderr, "SIM: %s is not a version %d snapshot\n",
+		        path, SNAPVERSION);
+		goto fail;
+	}
+	/* Sized from the header before anything is allocated to its counts */
+	if (hdr->nchunks < 0 || hdr->nlive < 0 || hdr->nawake < 0
+	    || hdr->landmask > (uint32_t)INT32_MAX)
+		goto corrupt;
+	sections(s, hdr, NULL, sec);
+	size = align(sizeof(*hdr));
+	for (i = 0; i < NSECS; i++)
+		size += align(sec[i].len);
+	if (size != hdr->size)
+		goto corrupt;
+
+	rval = -1;
+	if (sim_init(s, hdr->wid, hdr->hgt, hdr->nparticles, 0) < 0)
+		goto fail;
+	while (s->awakecap < hdr->nawake)
+		if (grow(s) < 0)
+			goto fail;
+
+	rval = -2;
+	index = (const uint32_t *)((const uint8_t *)map + align(sizeof(*hdr)));
+	if (hdr->landmask != s->landmask || hdr->nchunks > s->cw * s->ch
+	    || hdr->nlive > s->nparticles
+	    || hdr->nspawnx < 0 || hdr->nspawnx > RCRNG_LANES
+	    || hdr->flake < 1 || hdr->flake > 255
+	    || hdr->nfalling < 0 || hdr->nfalling > s->nparticles
+	    || hdr->budget < 0 || hdr->budget > s->nparticles
+	    || sim_spawnat(s, hdr->spawnx0, hdr->spawnw, hdr->spawnperiod) < 0)
+		goto corrupt;
+	sections(s, hdr, NULL, sec);
+
+	p = (const uint8_t *)index + align(sec[0].len);
+	for (i = 0; i < hdr->nchunks; i++) {
+		struct sim_chunk **c;
+		if (index[i] >= (uint32_t)(s->cw * s->ch)
+		    || *(c = &s->chunks[index[i]]) != NULL)
+			goto corrupt;
+		if ((*c = malloc(sizeof(**c))) == NULL) {
+			rval = -1;
+			goto fail;
+		}
+		memcpy(*c, p, sizeof(**c));
+		p += sizeof(**c);
+	}
+	s->nchunks = hdr->nchunks;
+	p = (const uint8_t *)index + align(sec[0].len) + align(sec[1].len);
+	for (i = 2; i < NSECS; i++) {
+		if (sec[i].len)
+			memcpy(sec[i].p, p, sec[i].len);
+		p += align(sec[i].len);
+	}
+
+	s->nlive = hdr->nlive;
+	s->freedrop = hdr->freedrop;
+	s->nawake = hdr->nawake;
+	s->nsnow = hdr->nsnow;
+	s->thaw = hdr->thaw;
+	s->nspawnx = hdr->nspawnx;
+	s->flake = hdr->flake;
+	s->nfalling = hdr->nfalling;
+	s->budget = hdr->budget;
+	s->user = hdr->user;
+	s->thawword = hdr->thawword;
+	s->frame = hdr->frame;
+	s->thawrng = hdr->thawrng;
+	s->spawnrng = hdr->spawnrng;
+	memcpy(s->spawnx, hdr->spawnx, sizeof(s->spawnx));
+	if (!sane(s))
+		goto corrupt;
+	munmap(map, st.st_size);
+	return 0;
+
+corrupt:
+	fprintf(stderr, "SIM: %s is corrupt\n", path);
+fail:
+	munmap(map, st.st_size);
+	sim_free(s);
+	return rval;
+}
@@ -0,0 +1,168 @@
+/* SIM - Snowfall particle simulation
+ *
+ * The simulation behind SNOW, split out so it can be run without a display
+ * for regression tests and benchmarks.
+ *
+ * The world is wid x hgt cells of 8-bit palette indices, anything non-zero is
+ * an obstacle to the falling flakes. Flakes being stepped are drawn into it
+ * too, in colour flake, SIM_FLAKE unless set. It is split into chunks
+ * SIM_CHUNK cells square, only allocated once something is drawn or comes to
+ * rest in them, so open sky takes no memory and a scene can be far wider than
+ * the screen. Nothing is done per chunk each step, the work follows the lists
+ * of what is moving below, so chunks with nothing moving in them sleep for
+ * free. Grains cross into neighbouring chunks, and wake the grains over the
+ * edge, cell by cell as anywhere else. sim_draw and sim_drawstill render a
+ * viewport from the chunks it covers.
+ *
+ * A chunk's cells are stored a row at a time. Built with SIM_BRICKBITS 3 or
+ * 4 they are in 8x8 or 16x16 bricks instead, so a flake falling a few rows
+ * stays in the same few cache lines, and sim_draw turns them back into rows
+ * as it copies the view. Rows of a 64-wide chunk are a cache line apart
+ * already, and make bench-bricks finds the rows no slower at 4K, so rows are
+ * the default. The results don't depend on the layout, but snapshots only
+ * load into a build with the same one.
+ *
+ * A flake above everything solid in its column can only fall straight down
+ * until it reaches the top of the column, so it is not stepped at all. It is
+ * put in drops[] with the frame it will get there on, and is at row
+ * y0 + (frame - t0) in the meantime, not drawn into its cell. top[] keeps
+ * the top of each column up to date as snow settles or is cleared, and the
+ * drops in a column are looked at again when it changes. Only the flakes
+ * that have landed, sliding over a pile or under scenery, are stepped a
+ * pixel at a time, so a step costs about as much as the landings in it.
+ * sim_draw puts the drops into the view.
+ *
+ * Flakes that come to rest become grains of snow. A grain sleeps once all it
+ * rests on is solid, scenery or other sleeping grains, and is marked in the
+ * solid and snow bitmaps of its chunk. Only those solid cells can then hold
+ * it up, so the grains above a solid cell are woken when it is cleared, and
+ * stepped like flakes until they can sleep again. Piles collapse when what
+ * holds them up falls away, at a cost that follows how much is moving rather
+ * than how much snow there is, and falling flakes never have to check for
+ * sleepers.
+ *
+ * Every flake that comes to rest is replaced by a new one along the top, so
+ * the same number stay in the air. sim_budget changes how many, adding
+ * flakes at once or letting them go as they stop, so a display can trade
+ * snow for frame time while it runs.
+ *
+ * Grains put to sleep are listed in settled[] after each step, and grains
+ * woken or thawed in woken[] and melted[], so a display can add them to or
+ * take them off its static layer. Awake grains are drawn like falling flakes.
+ *
+ * Obstacles are stamped in from masks, a sprite's opaque pixels packed a bit
+ * each by sim_maskinit, so they are set and cleared in the solid bitmaps a
+ * word at a time. Only opaque pixels are touched, obstacles can be layered,
+ * taken away with sim_unstamp and stamped again elsewhere to move them.
+ *
+ * Left alone the snow piles up until the world is full. sim_thaw sets a fill
+ * level to hold it at instead, for displays that run for weeks. Each step
+ * past it melts about as many grains as settled, plus a share of the excess,
+ * taken at random from the grains with nothing solid on or beside their top,
+ * so thawing hardly ever starts an avalanche. They are found a bitmap word,
+ * 64 cells, at a time, sweeping the whole world every few steps, so the cost
+ * of a step levels off along with the snow.
+ *
+ * sim_save writes the whole state, chunks, flakes, drops, awake grains,
+ * random streams and frame count, to a versioned snapshot, and sim_load
+ * maps one back in and carries on stepping exactly where it left off. A
+ * display can start up on snow that took hours to fall, or come back from
+ * a crash without the scene resetting. It can keep a few bits of its own
+ * state in user to come back with too.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include "rcrng.h"
+#include <stdint.h>
+
+#define SIM_WID     320         // The screen, and the default world
+#define SIM_HGT     200
+#define SIM_FLAKE   0xF
+#define SIM_CHUNKBITS   6
+#define SIM_CHUNK   (1 << SIM_CHUNKBITS)
+#ifndef SIM_BRICKBITS
+#define SIM_BRICKBITS   SIM_CHUNKBITS   // Build with 3 or 4 for bricks
+#endif
+
+struct sim_particle {
+	int x, y;
+};
+
+struct sim_drop {
+	int x, y0;                  // Column, -1 if unused, and row on frame t0
+	uint32_t t0, land;          // Frame it reaches the top of its column
+	int prev, next;             // Drops landing on the same frame
+	int cprev, cnext;           // Drops in the same column
+};
+
+/* An obstacle's opaque pixels, a bit each, to stamp into a scene */
+struct sim_mask {
+	const uint8_t *spr;         // Colours, not copied
+	int w, h;
+	int words;                  // Bitmap words per row
+	uint64_t *bits;             // Bit j%64 of word j/64 of a row is pixel j
+};
+
+struct sim_chunk;
+
+struct sim {
+	int wid, hgt;
+	struct sim_chunk **chunks;  // cw*ch, row by row, NULL until needed
+	int cw, ch, nchunks;        // cw is a power of two, rounded up
+	int cwbits;                 // log2 cw
+	int *x, *y;                 // Flakes being stepped
+	int nlive;
+	struct sim_drop *drops;     // Flakes in free fall, nparticles slots
+	int nparticles;
+	int nfalling;               // Flakes in the air, stepped or dropped
+	int nspawned;               // Flakes spawned during the last step
+	int budget;                 // Flakes to keep in the air, see sim_budget
+	int freedrop;               // Unused drops, linked by next
+	int *top;                   // First solid row of each column, or hgt
+	int *column;                // First drop in each column, or -1
+	int *landing;               // First drop landing on each frame, or -1
+	unsigned landmask;          // Frames in landing[] - 1, a power of 2 > hgt
+	int *ax, *ay;               // Awake grains
+	int nawake, awakecap;
+	struct sim_particle *settled;   // Grains put to sleep during the last step
+	int nsettled;
+	struct sim_particle *woken;     // Grains woken during the last step
+	int nwoken;
+	int nsnow;                  // Sleeping grains
+	int thaw;                   // Sleeping grains to thaw back to, 0 for none
+	unsigned thawword;          // Next bitmap word the thaw looks at
+	struct rcrng thawrng;       // Picks the grains to thaw
+	struct sim_particle *melted;    // Grains thawed during the last step
+	int nmelted, meltcap;
+	uint32_t frame;             // Steps taken
+	struct rcrng8 spawnrng;     // Picks the columns flakes spawn in
+	uint32_t spawnx[RCRNG_LANES];   // Columns not yet used, as indexes
+	int nspawnx;
+	int spawnx0, spawnw, spawnperiod;   // See sim_spawnat
+	int spawnn;                 // Columns flakes can spawn in
+	uint8_t flake;              // Colour of flakes and settled snow
+	uint32_t user;              // The display's own, kept in snapshots
+};
+
+int sim_init(struct sim *s, int wid, int hgt, int nparticles, unsigned seed);
+void sim_free(struct sim *s);
+int sim_sprite(struct sim *s, const uint8_t *spr, int x, int y, int w, int h);
+void sim_erase(struct sim *s, int x, int y, int w, int h);
+int sim_maskinit(struct sim_mask *m, const uint8_t *spr, int w, int h);
+void sim_maskfree(struct sim_mask *m);
+int sim_stamp(struct sim *s, const struct sim_mask *m, int x, int y);
+void sim_unstamp(struct sim *s, const struct sim_mask *m, int x, int y);
+int sim_spawn(struct sim *s);
+int sim_spawnat(struct sim *s, int x0, int w, int period);
+int sim_budget(struct sim *s, int n);
+void sim_step(struct sim *s);
+double sim_forward(struct sim *s, long steps);
+void sim_thaw(struct sim *s, int fill);
+void sim_draw(const struct sim *s, uint8_t *dst, int x, int y, int w, int h);
+void sim_drawstill(const struct sim *s, uint8_t *dst, int x, int y, int w,
+                   int h);
+int sim_save(struct sim *s, const char *path);
+int sim_load(struct sim *s, const char *path);
+
+#endif
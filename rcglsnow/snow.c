@@ -1,139 +1,766 @@
 /* SNOW - Hayden Kroepfl 2017
- * 
+ *
  * A simple snowfall particle simulation originally written for Mode 13h VGA
- * 
- * As the snow reaches the top of the screen the density will increase as there
- * are always 200 particles falling at once. Once the screen is full the program
- * will hang and not respond to input, don't let this happen. This is due to the
- * infinite loop tying to randomly find a space to spawn the particle. Either
- * fix this loop to have an exit, or make it such that the snow doesn't reach 
- * the top of the screen.
- * 
+ *
+ * As the snow reaches the top of the screen the density increases, as the
+ * scene's flakes keep falling at once, or as many as -a settles on. Once the
+ * top row is full new flakes wait for room to spawn in, so the snow thins out
+ * and the screen stays full, unless -f thaws it.
+ *
  * This file was originally written for Turbo C 2.0 on a Turbo PC/XT clone.
  * This version has been modified to use my RCGL graphics wrapper library, and
- * thus requires SDL2.
- * 
- * The files vgatree and vgamerry.h contain the image data displayed for the 
- * snow to fall on top.
+ * thus requires SDL2. The simulation itself lives in sim.c.
+ *
+ * The tree and merry art, along with settled snow, is drawn once into the
+ * static bottom layer and only the rows that change are marked dirty, until
+ * the view is scrolled. The falling flakes, and any settled snow that is
+ * sliding, are handed to RCGL as a sparse point layer each frame, so no full
+ * frame has to be re-palettized.
+ *
+ * The image data displayed for the snow to fall on top, along with the
+ * palette, is loaded from an asset pack (snow.pak by default, or the first
+ * argument). The pack is built from vgatree.h and vgamerry.h by mkpak. What
+ * goes where, the palette, flake colour and count, where flakes spawn and
+ * the seed, come from a scene description, the "snow" scene in the pack
+ * unless another is named, see scene.h. Packs without one get the original.
+ *
+ * usage: snow [-p name] [-r out.gif|out.y4m] [-s seed] [-t frames [-g golden]]
+ *             [-w width] [-d WxH] [-f fill] [-k snapshot] [-F steps]
+ *             [-S scene] [-a ms] [-m metrics] [pack]
+ *   -p  Publish the display to shared memory for rcglview, e.g. -p /snow
+ *   -r  Record the display to an animated GIF or Y4M video
+ *   -s  Random seed, instead of the scene's
+ *   -w  Width of the world, a panorama repeating the scene every screen with
+ *       as many flakes per screen. One screen by default
+ *   -d  Size of the screen, 320x200 by default or larger. The scene is laid
+ *       out in proportion and the flakes scale with the area
+ *   -f  Thaw settled snow to hold it at this percentage of the world, so it
+ *       can run indefinitely. Off by default, the screen fills up
+ *   -k  Keep the snow in a snapshot file. If it exists the simulation carries
+ *       on from it rather than starting over, and it is saved every minute
+ *       and on the way out. Test mode saves it at the end, so a snowed in
+ *       scene can be built up headless ahead of time
+ *   -F  Fast-forward this many steps before showing anything, printing how
+ *       many steps a second that ran at. With -k and -t 1, bakes a scene
+ *   -S  Scene to show, a file (with a . or / in it) or one in the pack
+ *   -a  Adapt the number of flakes, within the scene's range, to take about
+ *       this many milliseconds a frame to step and draw, e.g. -a 4. Each
+ *       change is reported. Test mode keeps to the scene's number
+ *   -m  Export metrics every second, from the simulation and display, in
+ *       the Prometheus text format to a file or unix:/path for a socket
+ *   -t  Test mode, run headless for the given number of frames printing a
+ *       hash of every frame along with frame time statistics
+ *   -g  Compare the test mode hashes against a golden list instead
+ *
+ * If the display stalls for more than a second, e.g. the machine sleeping,
+ * the missed steps are fast-forwarded through unseen so the snow doesn't
+ * fall behind, up to CATCHUP of them.
+ *
+ * Press the key the scene gives a sprite, M for the merry signs, to take it
+ * down and let its snow fall, or put it back up, and Left and Right to
+ * scroll a wider world. Press Escape or close the window to quit.
  */
 #include "rcgl.h"
-#include "vgatree.h"
-#include "vgamerry.h"
+#include "rcmetrics.h"
+#include "rcpak.h"
+#include "scene.h"
+#include "sim.h"
+#include <stdio.h>
 #include <stdlib.h>
-
-char *scr;
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 typedef unsigned int uint;
-typedef unsigned char uchar;
-typedef signed char schar;
-typedef unsigned short ushort;
 
-/* scr[y * 320 + x] */
-#define px(x,y) *(scr + (((y)<<8) + ((y)<<6) + (x)))
+#define MAXSCALE 1280      /* Window width the screen is scaled up to */
+
+#define FPS 70      /* Mode 13h refresh rate */
+#define SAVEEVERY (60*FPS)  /* Frames between snapshots */
+#define CATCHUP (600*FPS)   /* Most frames to fast-forward after a stall */
+#define ADAPTEVERY (FPS/2)  /* Frames between changes to the flake budget */
+#define METRICSEVERY 1000   /* ms between metrics exports */
+
+struct sim sim;
+uint8_t *bg;
+int scrw = SIM_WID, scrh = SIM_HGT;    // The screen, a window on the world
+
+struct scene scene;
+struct sim_mask masks[SCENE_MAXSPRITES];    // One per scene sprite
+int spritex[SCENE_MAXSPRITES], spritey[SCENE_MAXSPRITES];  // On each screen
+int spriteup[SCENE_MAXSPRITES];
+
+double adaptms;             // Work a frame the flakes are adapted to, or 0
+int minflakes, maxflakes;   // The range they are adapted over
+
+/* Metrics, see rcmetrics.h */
+int m_steps, m_spawned, m_settled, m_woken, m_melted, m_step, m_draw;
+int m_flakes, m_budget, m_awake, m_grains, m_fill;
+uint32_t counted;           // sim.frame the steps have been counted up to
+
+struct rcgl_point *flakes;
+int flakecap, nflakes;
+int viewx;                  // Left edge of the screen in the world
+
+
+/*
+ * xxh32 - xxHash32 of a buffer, fast enough to hash every frame
+ */
+#define XXP1 2654435761U
+#define XXP2 2246822519U
+#define XXP3 3266489917U
+#define XXP4 668265263U
+#define XXP5 374761393U
+#define rotl(x,r) (((x) << (r)) | ((x) >> (32 - (r))))
+
+static uint32_t rd32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static uint32_t xxh32(const uint8_t *p, size_t len, uint32_t seed)
+{
+	const uint8_t *end = p + len;
+	uint32_t h;
+
+	if (len >= 16) {
+		uint32_t v1 = seed + XXP1 + XXP2, v2 = seed + XXP2;
+		uint32_t v3 = seed, v4 = seed - XXP1;
+		do {
+			v1 += rd32(p) * XXP2;    v1 = rotl(v1, 13) * XXP1;
+			v2 += rd32(p+4) * XXP2;  v2 = rotl(v2, 13) * XXP1;
+			v3 += rd32(p+8) * XXP2;  v3 = rotl(v3, 13) * XXP1;
+			v4 += rd32(p+12) * XXP2; v4 = rotl(v4, 13) * XXP1;
+			p += 16;
+		} while (p <= end - 16);
+		h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+	} else {
+		h = seed + XXP5;
+	}
+	h += len;
+	for (; p + 4 <= end; p += 4)
+		h = rotl(h + rd32(p) * XXP3, 17) * XXP4;
+	for (; p < end; p++)
+		h = rotl(h + *p * XXP5, 11) * XXP1;
+	h ^= h >> 15;
+	h *= XXP2;
+	h ^= h >> 13;
+	h *= XXP3;
+	h ^= h >> 16;
+	return h;
+}
+
+static int cmpdbl(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/*
+ * flake - Add a point for a flake at (x, y) in the world, if it is in view
+ */
+static void flake(int x, int y)
+{
+	if (x < viewx || x >= viewx + scrw)
+		return;
+	flakes[nflakes].x = x - viewx;
+	flakes[nflakes].y = y;
+	flakes[nflakes++].c = sim.flake;
+}
+
+/*
+ * metrics - Register what snow counts
+ */
+static void metrics(void)
+{
+	m_steps = rcmetrics_new("snow_steps_total", RCMETRICS_COUNTER,
+	                        "Simulation steps, fast-forwarded ones too");
+	m_spawned = rcmetrics_new("snow_spawned_total", RCMETRICS_COUNTER,
+	                          "Flakes spawned to replace those stopped");
+	m_settled = rcmetrics_new("snow_settled_total", RCMETRICS_COUNTER,
+	                          "Grains put to sleep");
+	m_woken = rcmetrics_new("snow_woken_total", RCMETRICS_COUNTER,
+	                        "Sleeping grains woken");
+	m_melted = rcmetrics_new("snow_melted_total", RCMETRICS_COUNTER,
+	                         "Grains thawed");
+	m_step = rcmetrics_new("snow_step_seconds_total", RCMETRICS_SECONDS,
+	                       "Stepping the simulation");
+	m_draw = rcmetrics_new("snow_draw_seconds_total", RCMETRICS_SECONDS,
+	                       "Handing frames to the display");
+	m_flakes = rcmetrics_new("snow_flakes", RCMETRICS_GAUGE,
+	                         "Flakes in the air");
+	m_budget = rcmetrics_new("snow_flake_budget", RCMETRICS_GAUGE,
+	                         "Flakes to keep in the air");
+	m_awake = rcmetrics_new("snow_awake", RCMETRICS_GAUGE,
+	                        "Grains sliding");
+	m_grains = rcmetrics_new("snow_grains", RCMETRICS_GAUGE,
+	                         "Grains asleep");
+	m_fill = rcmetrics_new("snow_fill_rows", RCMETRICS_GAUGE,
+	                       "Average depth of the snow");
+}
+
+/*
+ * count - Add the last step, which took ns, to the metrics
+ *
+ * Steps fast-forwarded since the last call are counted, but only the last
+ * step's grains.
+ */
+static void count(uint64_t ns)
+{
+	rcmetrics_add(m_steps, sim.frame - counted);
+	counted = sim.frame;
+	rcmetrics_add(m_spawned, sim.nspawned);
+	rcmetrics_add(m_settled, sim.nsettled);
+	rcmetrics_add(m_woken, sim.nwoken);
+	rcmetrics_add(m_melted, sim.nmelted);
+	rcmetrics_add(m_step, ns);
+	rcmetrics_set(m_flakes, sim.nfalling);
+	rcmetrics_set(m_budget, sim.budget);
+	rcmetrics_set(m_awake, sim.nawake);
+	rcmetrics_set(m_grains, sim.nsnow);
+	rcmetrics_set(m_fill, (double)sim.nsnow / sim.wid);
+}
+
+/*
+ * test - Run the simulation headless, hashing every frame
+ *
+ * Frame 0 is the scene after the initial spawn, each following frame is one
+ * step later, matching what the interactive loop shows on each update of
+ * the leftmost screen. Frames are numbered on from a loaded snapshot, and
+ * the golden list is compared from that frame on.
+ * Returns 0 if every hash matched the golden list (or no list was given).
+ *
+ * With thaw on it is a soak test as well, the snow must level off. Over the
+ * second half of the run it may not pass the fill level by more than a
+ * tenth, and the step times of the first and last quarters are shown to
+ * compare.
+ */
+static int test(int frames, const char *golden)
+{
+	uint8_t *frame;
+	FILE *gf = NULL;
+	double *t, sum = 0, first = 0, last = 0;
+	struct timespec t0, t1;
+	unsigned gframe, ghash;
+	uint32_t h;
+	int rval = 0, peak = 0, high = scrh, n;
 
-#define MAX_PARTICLES	200
+	if (golden && (gf = fopen(golden, "r")) == NULL) {
+		fprintf(stderr, "snow: Failed to open %s\n", golden);
+		return 1;
+	}
+	t = malloc(frames * sizeof(*t));
+	frame = malloc(scrw * scrh);
+	if (t == NULL || frame == NULL) {
+		free(t);
+		return 1;
+	}
 
+	for (int f = 0; f < frames; f++) {
+		sim_draw(&sim, frame, 0, 0, scrw, scrh);
+		h = xxh32(frame, scrw*scrh, 0);
+		if (gf == NULL) {
+			printf("%u %08x\n", sim.frame, h);
+		} else {
+			do
+				n = fscanf(gf, "%u %x", &gframe, &ghash);
+			while (n == 2 && gframe < sim.frame);
+			if (n != 2 || gframe != sim.frame) {
+				fprintf(stderr, "snow: %s ends before frame %u\n",
+				        golden, sim.frame);
+				rval = 1;
+				break;
+			} else if (ghash != h) {
+				fprintf(stderr, "snow: Frame %u hash %08x, expected %08x\n",
+				        sim.frame, h, ghash);
+				rval = 1;
+				break;
+			}
+		}
 
-#define WID 320
-#define HGT 200
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		sim_step(&sim);
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		t[f] = (t1.tv_sec - t0.tv_sec) * 1e6 + (t1.tv_nsec - t0.tv_nsec) / 1e3;
+		count(t[f] * 1e3);
+		sum += t[f];
+		if (f < frames/4)
+			first += t[f];
+		else if (f >= frames - frames/4)
+			last += t[f];
 
-struct PARTICLE {
-	int x, y;
-} particles[MAX_PARTICLES];
+		if (sim.thaw && f >= frames/2) {
+			if (sim.nsnow > peak)
+				peak = sim.nsnow;
+			for (int x = 0; x < sim.wid; x++)
+				if (sim.top[x] < high)
+					high = sim.top[x];
+		}
+	}
 
+	if (rval == 0) {
+		qsort(t, frames, sizeof(*t), cmpdbl);
+		fprintf(stderr, "snow: %d frames %s, step us: mean %.2f min %.2f "
+		        "median %.2f p99 %.2f max %.2f\n",
+		        frames, gf ? "match" : "hashed", sum / frames, t[0],
+		        t[frames/2], t[frames*99/100], t[frames-1]);
+	}
+	if (rval == 0 && sim.thaw && frames >= 4) {
+		fprintf(stderr, "snow: Second half fill peak %.1f%% of %.1f%%, "
+		        "highest row %d, step us: first quarter %.2f last %.2f\n",
+		        100.0 * peak / sim.wid / sim.hgt,
+		        100.0 * sim.thaw / sim.wid / sim.hgt, high,
+		        first / (frames/4), last / (frames/4));
+		if (peak > sim.thaw + sim.thaw/10) {
+			fprintf(stderr, "snow: Snow didn't level off\n");
+			rval = 1;
+		}
+	}
+	free(t);
+	free(frame);
+	if (gf)
+		fclose(gf);
+	return rval;
+}
+
+/*
+ * loadscene - Read the scene from a file if name looks like a path, with a
+ * dot or slash in it, otherwise from the pack
+ */
+static int loadscene(const struct rcpak *pak, const char *name)
+{
+	const struct rcpak_entry *e;
+	char *text;
+	long len;
+	FILE *fp;
+	int rval;
+
+	if (strpbrk(name, "./") != NULL) {
+		if ((fp = fopen(name, "rb")) == NULL) {
+			fprintf(stderr, "snow: Failed to open %s\n", name);
+			return -1;
+		}
+		fseek(fp, 0, SEEK_END);
+		len = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		if ((text = malloc(len + 1)) == NULL
+		    || fread(text, 1, len, fp) != (size_t)len) {
+			fprintf(stderr, "snow: Failed to read %s\n", name);
+			free(text);
+			fclose(fp);
+			return -1;
+		}
+		fclose(fp);
+		rval = scene_parse(&scene, text, len, name);
+		free(text);
+		return rval;
+	}
+	if ((e = rcpak_find(pak, RCPAK_SCENE, name)) != NULL)
+		return scene_parse(&scene, rcpak_data(pak, e), e->len, name);
+	if (strcmp(name, "snow") == 0) {
+		scene_default(&scene);
+		return 0;
+	}
+	fprintf(stderr, "snow: No scene %s\n", name);
+	return -1;
+}
+
+/*
+ * putup - Stamp sprite i back on every screen
+ *
+ * Returns -1 if there isn't the memory, with it taken down again wherever
+ * it went up.
+ */
+static int putup(int i)
+{
+	const struct sim_mask *m = &masks[i];
+	int x;
+
+	for (x = 0; x + scrw <= sim.wid; x += scrw)
+		if (sim_stamp(&sim, m, x + spritex[i], spritey[i]) < 0)
+			break;
+	if (x + scrw <= sim.wid) {
+		for (; x >= 0; x -= scrw)
+			sim_unstamp(&sim, m, x + spritex[i], spritey[i]);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * toggle - Take the sprites the key is for down, or put them back up
+ *
+ * Which are up is kept in sim.user, a bit each, so a snapshot comes back
+ * with them the same. Returns 0 if no sprite has that key.
+ */
+static int toggle(char key)
+{
+	int i, x, n = 0;
+
+	for (i = 0; i < scene.nsprites; i++) {
+		if (scene.sprites[i].key != key)
+			continue;
+		if (spriteup[i]) {
+			for (x = 0; x + scrw <= sim.wid; x += scrw)
+				sim_unstamp(&sim, &masks[i], x+spritex[i], spritey[i]);
+			spriteup[i] = 0;
+		} else if (putup(i) == 0) {
+			spriteup[i] = 1;
+		} else {
+			fprintf(stderr, "snow: Out of memory putting %s back up\n",
+			        scene.sprites[i].name);
+		}
+		sim.user = (sim.user & ~(1u << i)) | (uint32_t)spriteup[i] << i;
+		n++;
+	}
+	return n;
+}
+
+/*
+ * adapt - Move the flake budget towards what can be stepped and drawn in
+ * adaptms a frame, the last frame having taken ms
+ *
+ * The time is smoothed, and only acted on every ADAPTEVERY frames if it is
+ * a tenth over or a fifth under, so the budget settles rather than hunting.
+ * It is scaled from the flakes still in the air, which lag behind a cut.
+ * Cuts are up to a quarter at a time and rises an eighth, a stutter being
+ * worse than sparse snow.
+ */
+static void adapt(double ms)
+{
+	static double avg;
+	static int frames;
+	double want;
+	int n = sim.budget;
+
+	avg += (ms - avg) / 8;
+	if (++frames < ADAPTEVERY)
+		return;
+	frames = 0;
+	want = avg > 0 ? sim.nfalling * adaptms / avg : maxflakes;
+	if (avg > adaptms * 1.1) {
+		if (want < n * 0.75)
+			want = n * 0.75;
+		if (want < n)
+			n = want;
+	} else if (avg < adaptms * 0.8) {
+		if (want > sim.nfalling * 1.125 + 1)
+			want = sim.nfalling * 1.125 + 1;
+		if (want > n)
+			n = want;
+	}
+	if (n < minflakes)
+		n = minflakes;
+	if (n > maxflakes)
+		n = maxflakes;
+	if (n != sim.budget && sim_budget(&sim, n) == 0)
+		fprintf(stderr, "snow: %d flakes at %.2f ms a frame\n", n, avg);
+}
 
 int main(int argc, char **argv)
 {
-	uint i, j;
-	int cx, cy;
+	uint i;
+	struct rcpak pak;
+	const uint8_t *spr;
+	const uint32_t *pal;
+	int fl, nfl, wid = 0, fill = -1, x, w, h, loaded = 0, rval;
+	struct rcgl_event ev;
+	const char *recpath = NULL, *golden = NULL, *pubname = NULL;
+	const char *keep = NULL, *scenename = "snow", *metricsto = NULL;
+	unsigned seed = 0;
+	int seedset = 0;
+	int frames = 0;
+	long forward = 0;
+	int opt;
+	uint64_t next, now, behind, t0, t1, t2;
+	uint32_t saved;
+
+	while ((opt = getopt(argc, argv, "p:r:s:t:g:w:d:f:k:F:S:a:m:")) != -1) {
+		switch (opt) {
+		case 'p':
+			pubname = optarg;
+			break;
+		case 'r':
+			recpath = optarg;
+			break;
+		case 's':
+			seed = strtoul(optarg, NULL, 0);
+			seedset = 1;
+			break;
+		case 't':
+			frames = atoi(optarg);
+			break;
+		case 'g':
+			golden = optarg;
+			break;
+		case 'w':
+			wid = atoi(optarg);
+			break;
+		case 'd':
+			if (sscanf(optarg, "%dx%d", &scrw, &scrh) != 2
+			    || scrw < SIM_WID || scrh < SIM_HGT) {
+				fprintf(stderr, "snow: Screen must be at least %dx%d\n",
+				        SIM_WID, SIM_HGT);
+				return -1;
+			}
+			break;
+		case 'f':
+			fill = atoi(optarg);
+			break;
+		case 'k':
+			keep = optarg;
+			break;
+		case 'F':
+			forward = atol(optarg);
+			break;
+		case 'S':
+			scenename = optarg;
+			break;
+		case 'a':
+			adaptms = atof(optarg);
+			break;
+		case 'm':
+			metricsto = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: snow [-p name] [-r out.gif|out.y4m] "
+			        "[-s seed] [-t frames [-g golden]] [-w width] "
+			        "[-d WxH] [-f fill] [-k snapshot] [-F steps] [-S scene] "
+			        "[-a ms] [-m metrics] [pack]\n");
+			return -1;
+		}
+	}
+	if (wid < scrw)
+		wid = scrw;
+
+	if (rcpak_open(&pak, optind < argc ? argv[optind] : "snow.pak") < 0)
+		return -1;
+	if (loadscene(&pak, scenename) < 0)
+		return -1;
+	if ((pal = rcpak_palette(&pak, scene.palette)) == NULL) {
+		fprintf(stderr, "snow: Asset pack is missing palette %s\n",
+		        scene.palette);
+		return -1;
+	}
+	for (i = 0; i < (uint)scene.nsprites; i++) {
+		spr = rcpak_sprite(&pak, scene.sprites[i].name, &w, &h);
+		if (spr == NULL) {
+			fprintf(stderr, "snow: Asset pack is missing sprite %s\n",
+			        scene.sprites[i].name);
+			return -1;
+		}
+		if (sim_maskinit(&masks[i], spr, w, h) < 0)
+			return -1;
+		scene_place(&scene.sprites[i], w, h, scrw, scrh,
+		            &spritex[i], &spritey[i]);
+	}
+	if (!seedset)
+		seed = scene.seed;
+
+	/* Carry on from the last snapshot, it already has the scene in it */
+	if (keep && access(keep, F_OK) == 0) {
+		if (sim_load(&sim, keep) == 0 && sim.hgt == scrh && sim.wid >= scrw) {
+			loaded = 1;
+			wid = sim.wid;
+		} else {
+			fprintf(stderr, "snow: Starting afresh instead of from %s\n",
+			        keep);
+			sim_free(&sim);
+		}
+	}
+	/* Flakes are given per 320x200, scale them with the area */
+	if (!loaded) {
+		if (sim_init(&sim, wid, scrh, (long)scene.flakes * wid * scrh
+		                              / (SCENE_WID*SCENE_HGT), seed) < 0)
+			return -1;
+		sim.flake = scene.colour;
+		if (scene.spawnx0 > 0 || scene.spawnx1 < SCENE_WID) {
+			x = scene.spawnx0 * scrw / SCENE_WID;
+			sim_spawnat(&sim, x, scene.spawnx1 * scrw / SCENE_WID - x, scrw);
+		}
+	}
 
+	/* Every sprite starts up, unless it was taken down before a snapshot */
+	if (!loaded)
+		sim.user = (1u << scene.nsprites) - 1;
+	for (i = 0; i < (uint)scene.nsprites; i++)
+		spriteup[i] = sim.user >> i & 1;
 
-	if (rcgl_init(WID, HGT, WID*4, HGT*4,
+	minflakes = (long)scene.minflakes * wid * scrh / (SCENE_WID*SCENE_HGT);
+	maxflakes = (long)scene.maxflakes * wid * scrh / (SCENE_WID*SCENE_HGT);
+
+	/* Draw initial drawings for snow to fall on, on every screen */
+	for (x = 0; !loaded && x + scrw <= wid; x += scrw) {
+		for (i = 0; i < (uint)scene.nsprites; i++) {
+			if (sim_stamp(&sim, &masks[i], x+spritex[i], spritey[i]) < 0) {
+				fprintf(stderr, "snow: Out of memory for the scene\n");
+				return -1;
+			}
+		}
+	}
+	if (fill >= 0)
+		sim_thaw(&sim, fill);
+
+	if (!loaded && sim_spawn(&sim) < 0)
+		return -1;
+	metrics();
+	counted = sim.frame;
+	if (metricsto && rcmetrics_start(metricsto, METRICSEVERY) < 0)
+		fprintf(stderr, "snow: Not exporting metrics to %s\n", metricsto);
+	if (forward > 0)
+		fprintf(stderr, "snow: Fast-forwarded %ld steps at %.0f steps/s\n",
+		        forward, sim_forward(&sim, forward));
+
+	if (frames > 0) {
+		rval = test(frames, golden);
+		if (keep && sim_save(&sim, keep) < 0)
+			rval = 1;
+		rcmetrics_stop();
+		return rval;
+	}
+
+	x = scrw < MAXSCALE ? MAXSCALE/scrw : 1;
+	if (rcgl_init(scrw, scrh, scrw*x, scrh*x,
 	              "RCGL Test Window",
 	              RCGL_INTSCALE | RCGL_RESIZE) < 0)
 		return -1;
-		
-	/* Get pointer to screen */
-	scr = rcgl_getbuf();
+
+	/* Background layer only changes where snow settles */
+	bg = rcgl_getbuf();
+	rcgl_setautodirty(0, 0);
+	if ((fl = rcgl_newlayer(RCGL_SPARSE)) < 0) {
+		rcgl_quit();
+		return -1;
+	}
 	/* Mode 13h default palette */
-	rcgl_setpalette(RCGL_PALETTE_VGA);
-	
-
-	/* Clear screen */
-	for (i = 0; i < 32000; i++)
-		*(((ushort *)scr)+i) = 0x0000;
-
-	/* Draw initial drawings for snow to fall on */
-#define TREEX 40
-#define TREEY (199-TREEHGT)
-	for (i = 0; i < TREEHGT; i++)
-		for (j = 0; j < TREEWID; j++)
-			px(TREEX+j, TREEY+i) = tree[i*TREEWID + j];
-#define MERRYX 170
-#define MERRYY 120
-	for (i = 0; i < MERRYHGT; i++)
-		for (j = 0; j < MERRYWID; j++)
-			px(MERRYX+j, MERRYY+i) = merry[i*MERRYWID + j];
-
-
-	for (i = 0; i < MAX_PARTICLES; i++) {
-		do {
-			cx = particles[i].x = rand() % 320;
-			cy = particles[i].y = i / (MAX_PARTICLES/200);
-		} while (px(cx,cy) != 0);
+	rcgl_setpalette(pal);
 
-		px(particles[i].x, particles[i].y) = 0xF;
+	if (recpath) {
+		const char *ext = strrchr(recpath, '.');
+		if (rcgl_record_start(recpath, (ext && !strcmp(ext, ".y4m"))
+		                               ? RCGL_REC_Y4M : RCGL_REC_GIF, FPS) < 0)
+			fprintf(stderr, "snow: Not recording to %s\n", recpath);
 	}
 
+	if (pubname && rcgl_publish(pubname) < 0)
+		fprintf(stderr, "snow: Not publishing to %s\n", pubname);
+
+	sim_drawstill(&sim, bg, viewx, 0, scrw, scrh);
+	rcgl_dirty(0, 0, scrh);
+
 
 	/* Update particles */
+	saved = sim.frame;
+	next = rcgl_now_ns();
 	while (!rcgl_hasquit()) {
+		t0 = rcgl_now_ns();
+		nfl = sim.nparticles + sim.nawake;
+		if (nfl > flakecap) {
+			struct rcgl_point *p = realloc(flakes, nfl * 2 * sizeof(*p));
+			if (p == NULL)
+				break;
+			flakes = p;
+			flakecap = nfl * 2;
+		}
+		nflakes = 0;
+		for (i = 0; i < (uint)sim.nlive; i++)
+			flake(sim.x[i], sim.y[i]);
+		for (i = 0; i < (uint)sim.nparticles; i++) {
+			const struct sim_drop *d = &sim.drops[i];
+			if (d->x >= 0)
+				flake(d->x, d->y0 + (int)(sim.frame - d->t0));
+		}
+		for (i = 0; i < (uint)sim.nawake; i++)
+			flake(sim.ax[i], sim.ay[i]);
+		rcgl_setpoints(fl, flakes, nflakes);
 		rcgl_update();
-		for (i = 0; i < MAX_PARTICLES; i++) {
-			cx = particles[i].x;
-			cy = particles[i].y;
-
-			if (cy == 199 || px(cx,cy+1) != 0) {
-				/* Try and spread out first */
-				if (cx != 0 && cy != 199 && px(cx-1,cy+1) == 0) {
-					/* Move down and left */
-					px(cx, cy) = 0;
-					cx--; cy++;
-					px(cx, cy) = 0xF;
-					particles[i].x = cx;
-					particles[i].y = cy;
-				} else if (cx != 319 && cy != 199 && px(cx+1,cy+1) == 0) {
-					/* Move down and right */
-					px(cx, cy) = 0;
-					cx++; cy++;
-					px(cx, cy) = 0xF;
-					particles[i].x = cx;
-					particles[i].y = cy;
-				} else {
-					/* Halt particle by removing from list */
-					for (j = i; j < MAX_PARTICLES-1; j++) {
-						particles[j] = particles[j+1];
-					}
-					/* Replace with new particle */
-					do {
-						cx = particles[MAX_PARTICLES-1].x = rand() % 320;
-					} while (px(cx, 0) != 0);
-					cy = particles[MAX_PARTICLES-1].y = 0;
-					px(cx, cy) = 0xF;
-				}
+		t1 = rcgl_now_ns();
+
+		while (rcgl_poll_event(&ev)) {
+			if (ev.type != RCGL_KEYDOWN)
+				continue;
+			if (ev.key == RCGL_KEY_ESCAPE)
+				goto done;
+			if (ev.key >= RCGL_KEY_A && ev.key < RCGL_KEY_A+26) {
+				if (!toggle('a' + ev.key - RCGL_KEY_A))
+					continue;
+			} else if (ev.key == RCGL_KEY_LEFT) {
+				viewx = viewx > scrw/4 ? viewx - scrw/4 : 0;
+			} else if (ev.key == RCGL_KEY_RIGHT) {
+				viewx = viewx + scrw/4 < wid - scrw ? viewx + scrw/4
+				                                  : wid - scrw;
 			} else {
-				/* Move particle down */
-				px(cx, cy) = 0;
-				cy++;
-				px(cx, cy) = 0xF;
-				particles[i].y = cy;
+				continue;
 			}
+			sim_drawstill(&sim, bg, viewx, 0, scrw, scrh);
+			rcgl_dirty(0, 0, scrh);
 		}
-		
-	}
 
+		t2 = rcgl_now_ns();
+		sim_step(&sim);
+
+		/* Halted particles become part of the scenery, until woken */
+		for (i = 0; i < (uint)sim.nsettled; i++) {
+			x = sim.settled[i].x - viewx;
+			if (x < 0 || x >= scrw)
+				continue;
+			bg[sim.settled[i].y*scrw + x] = sim.flake;
+			rcgl_dirty(0, sim.settled[i].y, 1);
+		}
+		for (i = 0; i < (uint)sim.nwoken; i++) {
+			x = sim.woken[i].x - viewx;
+			if (x < 0 || x >= scrw)
+				continue;
+			bg[sim.woken[i].y*scrw + x] = 0;
+			rcgl_dirty(0, sim.woken[i].y, 1);
+		}
+		for (i = 0; i < (uint)sim.nmelted; i++) {
+			x = sim.melted[i].x - viewx;
+			if (x < 0 || x >= scrw)
+				continue;
+			bg[sim.melted[i].y*scrw + x] = 0;
+			rcgl_dirty(0, sim.melted[i].y, 1);
+		}
+
+		now = rcgl_now_ns();
+		count(now - t2);
+		rcmetrics_add(m_draw, t1 - t0);
+		if (adaptms > 0)
+			adapt((t1 - t0 + now - t2) / 1e6);
+
+		if (keep && sim.frame - saved >= SAVEEVERY) {
+			sim_save(&sim, keep);
+			saved = sim.frame;
+		}
+
+		/* Updates don't wait for the display, keep the old pace */
+		next += 1000000000 / FPS;
+		if (next < (now = rcgl_now_ns())) {
+			behind = (now - next) / (1000000000 / FPS);
+			if (behind > FPS) {
+				sim_forward(&sim, behind < CATCHUP ? behind : CATCHUP);
+				sim_drawstill(&sim, bg, viewx, 0, scrw, scrh);
+				rcgl_dirty(0, 0, scrh);
+			}
+			next = rcgl_now_ns();
+		}
+		rcgl_wait_until(next);
+	}
 
+done:
+	rcmetrics_stop();
+	if (keep)
+		sim_save(&sim, keep);
+	if (recpath && rcgl_record_stop() > 0)
+		fprintf(stderr, "snow: Recording dropped frames\n");
 	rcgl_quit();
+	sim_free(&sim);
+	for (i = 0; i < (uint)scene.nsprites; i++)
+		sim_maskfree(&masks[i]);
+	rcpak_close(&pak);
+	free(flakes);
 
 	return 0;
 }